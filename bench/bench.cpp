@@ -0,0 +1,285 @@
+/*
+ * Cycle counts for the HAL's hot paths, measured under simavr (see the
+ * Makefile)
+ *
+ * Timer1 runs at the CPU clock, so its count across an operation is the
+ * operation's cycle count; the cost of starting and stopping it is
+ * measured first and taken off. On the 328P Timer1 is 16 bits wide. On
+ * the tiny85 it's 8 bits, so its overflow interrupt counts the high
+ * bits, and that ISR's own cost (calibrated against a known delay loop)
+ * is taken off too.
+ *
+ * Everything runs with the Ticker's compare match interrupt off, so it
+ * can't land inside a measurement. The ISRs themselves are measured by
+ * calling their vectors, plus the 3 cycles the hardware spends more than
+ * a `call` getting there (a 4-cycle interrupt response and the vector
+ * table's 3-cycle `jmp`/`rjmp` versus a 4-cycle `call`); that's the
+ * interrupt's entry-to-exit time, not counting the wait for the current
+ * instruction to finish.
+ *
+ * Results go out through simavr's console register, one per line
+ *
+ *      @ cycles <name> <count>
+ *
+ * and the image ends by sleeping with interrupts off, which makes simavr
+ * exit.
+ */
+
+#include "avril.hpp"
+#include "utils/Format.hpp"
+#include "utils/LFSR.hpp"
+#include "utils/PcintDispatcher.hpp"
+#include "devices/Button.hpp"
+#include "devices/RotaryEncoderWithButton.hpp"
+#include "devices/QuadratureEncoder.hpp"
+
+#include <avr/sleep.h>
+
+extern "C" {
+#if defined(__AVR_ATtiny85__)
+void TIM0_COMPA_vect(void);
+#define TICKER_VECTOR TIM0_COMPA_vect
+#elif defined(__AVR_ATmega328P__)
+void TIMER0_COMPA_vect(void);
+#define TICKER_VECTOR TIMER0_COMPA_vect
+#endif
+}
+
+#define BARRIER() __asm__ __volatile__("" ::: "memory")
+
+// simavr's console (see mcu.c)
+struct Console {
+    static void printByte(uint8_t data) { GPIOR0 = data; }
+    static void print(const char* str)  { while (*str) printByte(*str++); }
+};
+
+// swallows output, so formatting can be timed without the UART
+struct NullSink {
+    static void printByte(uint8_t data) { GPIOR1 = data; }
+};
+
+namespace Cycles {
+
+static uint16_t overhead { 0 };
+
+#if defined(__AVR_ATtiny85__)
+
+static volatile uint16_t overflows { 0 };
+static uint8_t           perOverflow { 0 };  // the overflow ISR's own cost
+
+ISR(TIM1_OVF_vect) {
+    overflows = overflows + 1;
+}
+
+static inline void start() {
+    TCCR1     = 0;
+    TCNT1     = 0;
+    overflows = 0;
+    TIFR      = (1 << TOV1);
+    TIMSK    |= (1 << TOIE1);
+    sei();
+    TCCR1     = (1 << CS10);
+    BARRIER();
+}
+
+static inline uint32_t stop() {
+    BARRIER();
+    uint8_t count = TCNT1;
+    TCCR1 = 0;
+    cli();
+    uint16_t wraps = overflows;
+    // wrapped just before the read, and the ISR didn't get to run
+    if ((TIFR & (1 << TOV1)) && count < 0x80) ++wraps;
+    TIMSK &= ~(1 << TOIE1);
+    return static_cast<uint32_t>(wraps) * (256 - perOverflow) + count;
+}
+
+#elif defined(__AVR_ATmega328P__)
+
+static inline void start() {
+    TCCR1A = 0;
+    TCCR1B = 0;
+    TCNT1  = 0;
+    TIFR1  = (1 << TOV1);
+    TCCR1B = (1 << CS10);
+    BARRIER();
+}
+
+static inline uint32_t stop() {
+    BARRIER();
+    uint16_t count = TCNT1;
+    TCCR1B = 0;
+    return count;
+}
+
+#endif
+
+// exactly 4 * iterations + 1 cycles, setup included: two `ldi`, then
+// `sbiw` (2) and `brne` (2, or 1 when it falls through) per iteration
+template<uint16_t iterations>
+static inline void knownDelay() {
+    static_assert(iterations > 0, "0 would wrap round to 65536");
+    __asm__ __volatile__(
+        "ldi r24, lo8(%0)\n\t"
+        "ldi r25, hi8(%0)\n"
+        "1:\n\t"
+        "sbiw r24, 1\n\t"
+        "brne 1b"
+        :: "i" (iterations) : "r24", "r25");
+}
+
+static void calibrate() {
+    start();
+    uint32_t empty = stop();
+    overhead = static_cast<uint16_t>(empty);
+
+#if defined(__AVR_ATtiny85__)
+    // long enough to wrap a few times
+    constexpr uint16_t iterations { 1000 };
+    start();
+    knownDelay<iterations>();
+    uint32_t measured = stop() - overhead;
+    uint16_t wraps    = overflows;
+    uint32_t expected = 4UL * iterations + 1;
+    if (wraps && measured > expected)
+        perOverflow = static_cast<uint8_t>((measured - expected + wraps / 2) / wraps);
+#endif
+}
+
+}
+
+static void report(const char* name, uint32_t cycles) {
+    Console::print("@ cycles ");
+    Console::print(name);
+    Console::printByte(' ');
+    HAL::Utils::Format::dec<Console>(cycles);
+    Console::printByte('\n');
+}
+
+#define BENCH(name, ...)                                            \
+    do {                                                            \
+        Cycles::start();                                            \
+        __VA_ARGS__;                                                \
+        uint32_t cycles_ = Cycles::stop();                          \
+        report(name, cycles_ > Cycles::overhead                     \
+                     ? cycles_ - Cycles::overhead : 0);             \
+    } while (0)
+
+// an ISR called as a function: interrupts are back on after its `reti`
+#define BENCH_ISR(name, vector)                                     \
+    do {                                                            \
+        Cycles::start();                                            \
+        vector();                                                   \
+        uint32_t cycles_ = Cycles::stop();                          \
+        cli();                                                      \
+        report(name, cycles_ - Cycles::overhead + 3);               \
+    } while (0)
+
+static volatile uint8_t  sink8;
+static volatile uint32_t sink32;
+static uint8_t           buffer[32];
+
+#if defined(__AVR_ATtiny85__)
+// PB0; PB1, PB2/PB3; PB4/PB3
+constexpr uint8_t buttonPin { 5 };
+HAL::Devices::Button<buttonPin, 30, 1000, HIGH, true>         button;
+HAL::Devices::RotaryEncoderWithButton<6, 30, 1000, HIGH, true,
+                                      7, 2, 5, HIGH, true>    rewb;
+HAL::Devices::QuadratureEncoder<3, 2>                         quadrature;
+#elif defined(__AVR_ATmega328P__)
+// PB0; PB1, PB2/PB3; PC0/PC1
+constexpr uint8_t buttonPin { 14 };
+HAL::Devices::Button<buttonPin, 30, 1000, HIGH, true>         button;
+HAL::Devices::RotaryEncoderWithButton<15, 30, 1000, HIGH, true,
+                                      16, 17, 5, HIGH, true>  rewb;
+HAL::Devices::QuadratureEncoder<23, 24>                       quadrature;
+#endif
+
+using Pcint = HAL::Utils::PcintDispatcher<button>;
+HAL_PCINT_DISPATCH(Pcint, 0)
+
+int main() {
+    HAL::Ticker::setupMSTimer();
+    button.begin();
+    rewb.begin();
+    quadrature.begin();
+    Pcint::begin();
+    HAL::Utils::Random::LFSR::init(0xA5);
+    HAL::Utils::Random::Xorshift16::init(0xACE1);
+    HAL::Utils::Random::Xorshift32::init(2463534242UL);
+#if defined(__AVR_ATmega328P__)
+    HAL::UART::init<115200>();
+#endif
+    // no ticks in the middle of a measurement; advance() stands in
+#if defined(__AVR_ATtiny85__)
+    TIMSK &= ~(1 << OCIE0A);
+#elif defined(__AVR_ATmega328P__)
+    TIMSK0 &= ~(1 << OCIE0A);
+#endif
+    cli();
+
+    Cycles::calibrate();
+    Console::print("@ # " MCU_NAME "\n");
+
+    // a known cost; the Makefile refuses the results unless this comes
+    // out at exactly 4 * 100 + 1
+    BENCH("check_known_delay", Cycles::knownDelay<100>());
+
+    // Ticker
+    BENCH_ISR("ticker_isr", TICKER_VECTOR);
+    BENCH("ticker_getNumTicks",  sink32 = HAL::Ticker::getNumTicks());
+    BENCH("ticker_getMicros",    sink32 = HAL::Ticker::getMicros());
+
+    // Button
+    HAL::Ticker::advance(100);
+    BENCH("button_process_idle", sink8 = static_cast<uint8_t>(button.process()));
+    BENCH("button_notify",       button.notifyInterruptOccurred(HAL::Ticker::getNumTicks(),
+                                                                0xFF));
+    BENCH_ISR("pcint_dispatch_isr", PCINT0_vect);
+
+    // a debounced press: hold the pin low as an output (PINx reads the
+    // pin either way) and wait out the window
+    HAL::GPIO::GPIO<buttonPin>::setOutput();
+    HAL::GPIO::GPIO<buttonPin>::setLow();
+    // that was a pin change too; don't let it fire later
+#if defined(__AVR_ATtiny85__)
+    GIFR  = (1 << PCIF);
+#elif defined(__AVR_ATmega328P__)
+    PCIFR = (1 << PCIF0);
+#endif
+    button.notifyInterruptOccurred(HAL::Ticker::getNumTicks(), 0xFF);
+    HAL::Ticker::advance(50);
+    BENCH("button_process_press", sink8 = static_cast<uint8_t>(button.process()));
+    HAL::Ticker::advance(1000);
+    BENCH("button_process_long",  sink8 = static_cast<uint8_t>(button.process()));
+
+    // RotaryEncoderWithButton, QuadratureEncoder
+    BENCH("rewb_process_idle",   sink8 = static_cast<uint8_t>(rewb.process()));
+    BENCH("quadrature_notify",   quadrature.notifyInterruptOccurred(HAL::Ticker::getNumTicks(),
+                                                                    0xFF));
+    BENCH("quadrature_process",  sink8 = static_cast<uint8_t>(quadrature.process()));
+
+    // LFSR
+    BENCH("lfsr_nextByte",       sink8 = HAL::Utils::Random::LFSR::nextByte());
+    BENCH("lfsr_fill_32",        HAL::Utils::Random::LFSR::fill(buffer, sizeof(buffer)));
+    BENCH("lfsr_uniform_6",      sink8 = HAL::Utils::Random::LFSR::uniform(6));
+    BENCH("xorshift16_next",     sink32 = HAL::Utils::Random::Xorshift16::next());
+    BENCH("xorshift16_fill_32",  HAL::Utils::Random::Xorshift16::fill(buffer, sizeof(buffer)));
+    BENCH("xorshift16_uniform_1000", sink32 = HAL::Utils::Random::Xorshift16::uniform(1000));
+    BENCH("xorshift32_next",     sink32 = HAL::Utils::Random::Xorshift32::next());
+    BENCH("xorshift32_fill_32",  HAL::Utils::Random::Xorshift32::fill(buffer, sizeof(buffer)));
+    BENCH("xorshift32_uniform_1000", sink32 = HAL::Utils::Random::Xorshift32::uniform(1000));
+
+    // formatting, and the UART on top of it
+    BENCH("format_dec_u32",      HAL::Utils::Format::dec<NullSink>(static_cast<uint32_t>(4294967295UL)));
+    BENCH("format_hex_u16",      HAL::Utils::Format::hex<NullSink>(static_cast<uint16_t>(0xBEEF)));
+#if defined(__AVR_ATmega328P__)
+    BENCH("uart_print_u32",      HAL::UART::print(static_cast<uint32_t>(4294967295UL)));
+#endif
+
+    Console::print("@ # done\n");
+    cli();
+    sleep_enable();
+    sleep_cpu();
+    for (;;) { }
+}
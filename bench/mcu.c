@@ -0,0 +1,11 @@
+/*
+ * Tells simavr which MCU and clock the image is for, and which register
+ * is the console (everything written to it comes out on simavr's stdout,
+ * a line at a time)
+ */
+
+#include <avr/io.h>
+#include "avr_mcu_section.h"
+
+AVR_MCU(F_CPU, MCU_NAME);
+AVR_MCU_SIMAVR_CONSOLE(&GPIOR0);
@@ -0,0 +1,262 @@
+/*
+ * One module per image, for per-module .text/.data/.bss (see the
+ * Makefile): built once per name in MODULES with -DBENCH_MODULE_<name>,
+ * and `baseline` (an empty main) is taken off the rest. Each image
+ * actually uses its module, the way firmware would, so nothing gets
+ * optimised away that a real program would keep.
+ */
+
+#include "avril.hpp"
+
+#include <avr/interrupt.h>
+
+static volatile uint8_t  sink8;
+static volatile uint32_t sink32;
+
+#if defined(__AVR_ATtiny85__)
+constexpr uint8_t pinA { 5 }, pinB { 6 }, pinC { 7 };
+#elif defined(__AVR_ATmega328P__)
+constexpr uint8_t pinA { 14 }, pinB { 15 }, pinC { 16 };
+#endif
+
+#if defined(BENCH_MODULE_baseline)
+
+int main() {
+    for (;;) { }
+}
+
+#elif defined(BENCH_MODULE_ticker)
+
+int main() {
+    HAL::Ticker::setupMSTimer();
+    sei();
+    for (;;) sink32 = HAL::Ticker::getMicros();
+}
+
+#elif defined(BENCH_MODULE_debouncer)
+
+#include "utils/IntTransitionDebouncer.hpp"
+#include "utils/PcintDispatcher.hpp"
+
+HAL::Utils::IntTransitionDebouncer<pinA, 30, HIGH, true> debouncer;
+using Pcint = HAL::Utils::PcintDispatcher<debouncer>;
+HAL_PCINT_DISPATCH(Pcint, 0)
+
+int main() {
+    HAL::Ticker::setupMSTimer();
+    debouncer.begin();
+    Pcint::begin();
+    sei();
+    for (;;) sink8 = static_cast<uint8_t>(debouncer.processAnyInterrupts());
+}
+
+#elif defined(BENCH_MODULE_button)
+
+#include "devices/Button.hpp"
+#include "utils/PcintDispatcher.hpp"
+
+HAL::Devices::Button<pinA, 30, 1000, HIGH, true> button;
+using Pcint = HAL::Utils::PcintDispatcher<button>;
+HAL_PCINT_DISPATCH(Pcint, 0)
+
+int main() {
+    HAL::Ticker::setupMSTimer();
+    button.begin();
+    Pcint::begin();
+    sei();
+    for (;;) sink8 = static_cast<uint8_t>(button.process());
+}
+
+#elif defined(BENCH_MODULE_rewb)
+
+#include "devices/RotaryEncoderWithButton.hpp"
+#include "utils/PcintDispatcher.hpp"
+
+HAL::Devices::RotaryEncoderWithButton<pinA, 30, 1000, HIGH, true,
+                                      pinB, pinC, 5, HIGH, true> rewb;
+using Pcint = HAL::Utils::PcintDispatcher<rewb>;
+HAL_PCINT_DISPATCH(Pcint, 0)
+
+int main() {
+    HAL::Ticker::setupMSTimer();
+    rewb.begin();
+    Pcint::begin();
+    sei();
+    for (;;) sink8 = static_cast<uint8_t>(rewb.process());
+}
+
+#elif defined(BENCH_MODULE_quadrature)
+
+#include "devices/QuadratureEncoder.hpp"
+#include "utils/PcintDispatcher.hpp"
+
+HAL::Devices::QuadratureEncoder<pinB, pinC> encoder;
+using Pcint = HAL::Utils::PcintDispatcher<encoder>;
+HAL_PCINT_DISPATCH(Pcint, 0)
+
+int main() {
+    HAL::Ticker::setupMSTimer();
+    encoder.begin();
+    Pcint::begin();
+    sei();
+    for (;;) {
+        encoder.process();
+        sink8 = static_cast<uint8_t>(encoder.getAcceleratedDelta());
+    }
+}
+
+#elif defined(BENCH_MODULE_portdebouncer)
+
+#include "utils/PortDebouncer.hpp"
+
+using Panel = HAL::Utils::PortDebouncer<HAL::GPIO::Port::B, 0b00000111>;
+
+int main() {
+    Panel::begin();
+    HAL::Ticker::setupMSTimer();
+    HAL::Ticker::setTickHook(Panel::onTick);
+    sei();
+    for (;;) sink8 = Panel::takePressed();
+}
+
+#elif defined(BENCH_MODULE_timerqueue)
+
+#include "utils/TimerQueue.hpp"
+
+HAL::Utils::TimerQueue<4> timers;
+
+static void blink() { HAL::GPIO::GPIO<pinA>::toggle(); }
+
+int main() {
+    HAL::GPIO::GPIO<pinA>::setOutput();
+    HAL::Ticker::setupMSTimer();
+    sei();
+    timers.startPeriodic(500, blink);
+    for (;;) timers.process();
+}
+
+#elif defined(BENCH_MODULE_lfsr)
+
+#include "utils/LFSR.hpp"
+
+int main() {
+    HAL::Utils::Random::LFSR::init(0xA5);
+    for (;;) sink8 = HAL::Utils::Random::LFSR::nextByte();
+}
+
+#elif defined(BENCH_MODULE_xorshift)
+
+#include "utils/LFSR.hpp"
+
+int main() {
+    HAL::Utils::Random::Xorshift32::init(2463534242UL);
+    for (;;) sink32 = HAL::Utils::Random::Xorshift32::uniform(1000);
+}
+
+#elif defined(BENCH_MODULE_format)
+
+#include "utils/Format.hpp"
+
+struct Sink {
+    static void printByte(uint8_t data) { sink8 = data; }
+};
+
+int main() {
+    for (;;) HAL::Utils::Format::dec<Sink>(static_cast<uint32_t>(sink32));
+}
+
+#elif defined(BENCH_MODULE_analog)
+
+using Adc = HAL::Analog::Converter<HAL::Analog::Reference::VCC, 16, 2>;
+HAL_ANALOG_ISR(Adc)
+
+int main() {
+    Adc::begin();
+    Adc::start<HAL::Analog::Trigger::FREE_RUNNING, 1, 2>();
+    sei();
+    HAL::Analog::Sample sample;
+    for (;;) {
+        if (Adc::read(sample)) sink32 = sample.value;
+    }
+}
+
+#elif defined(BENCH_MODULE_pwm)
+
+#if defined(__AVR_ATtiny85__)
+using Pwm = HAL::PWM<6, 20000>;     // OC1A
+#elif defined(__AVR_ATmega328P__)
+using Pwm = HAL::PWM<15, 20000>;    // OC1A
+#endif
+
+int main() {
+    Pwm::begin();
+    for (;;) Pwm::write(sink8);
+}
+
+#elif defined(BENCH_MODULE_softpwm)
+
+using Leds = HAL::SoftPWM::Driver<200, HAL::SoftPWM::gamma28, pinA, pinB, pinC>;
+HAL_SOFTPWM_ISR(Leds)
+
+int main() {
+    Leds::begin();
+    sei();
+    for (;;) {
+        if (!Leds::fading()) Leds::fadeTo(sink8 % 3, sink8, 1000);
+    }
+}
+
+#elif defined(BENCH_MODULE_spi)
+
+using Bus    = HAL::SPI::Bus<4000000>;
+using Device = HAL::SPI::Device<Bus, pinA>;
+HAL_SPI_ISR(Bus)
+
+static uint8_t buffer[16];
+
+static void onDone() { sink8 = buffer[0]; }
+
+int main() {
+    Bus::begin();
+    Device::begin();
+    sei();
+    for (;;) {
+        sink8 = Device::transfer(sink8);
+        Device::queue(buffer, buffer, sizeof(buffer), onDone);
+    }
+}
+
+#elif defined(BENCH_MODULE_i2c)
+
+using I2c = HAL::I2C::Master<400000>;
+HAL_I2C_ISR(I2c)
+
+static const uint8_t reg[] { 0x3B };
+static uint8_t sample[6];
+
+static void onSample(HAL::I2C::Status status) {
+    if (status == HAL::I2C::Status::OK) sink8 = sample[0];
+}
+
+int main() {
+    I2c::begin();
+    sei();
+    for (;;) {
+        if (!I2c::busy()) I2c::writeRead(0x68, reg, sizeof(reg), sample, sizeof(sample), onSample);
+    }
+}
+
+#elif defined(BENCH_MODULE_uart)
+
+int main() {
+#if defined(__AVR_ATmega328P__)
+    HAL::UART::init<115200>();
+    for (;;) HAL::UART::println(static_cast<uint32_t>(sink32));
+#else
+    for (;;) { }    // no UART on the tiny85
+#endif
+}
+
+#else
+#error "define BENCH_MODULE_<name> (see the Makefile)"
+#endif
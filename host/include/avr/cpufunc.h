@@ -0,0 +1,4 @@
+#pragma once
+
+#define _NOP()
+#define _MemoryBarrier() __asm__ __volatile__("" ::: "memory")
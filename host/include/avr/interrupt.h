@@ -0,0 +1,34 @@
+#pragma once
+
+/*
+ * ISR() just defines an ordinary function named after the vector, so host
+ * code (host.hpp) can call it. The vectors host.hpp raises are declared
+ * weak, so a program that doesn't define one still links.
+ */
+
+#include <avr/io.h>
+
+#define ISR(vector, ...) extern "C" void vector(void)
+#define EMPTY_INTERRUPT(vector) extern "C" void vector(void) { }
+#define ISR_BLOCK
+#define ISR_NOBLOCK
+#define ISR_NAKED
+#define ISR_ALIASOF(vector)
+#define reti()
+
+inline void sei() { SREG = SREG |  (1 << SREG_I); }
+inline void cli() { SREG = SREG & ~(1 << SREG_I); }
+
+extern "C" {
+#if defined(__AVR_ATtiny85__)
+void PCINT0_vect(void)       __attribute__((weak));
+void TIM0_COMPA_vect(void)   __attribute__((weak));
+void ADC_vect(void)          __attribute__((weak));
+#elif defined(__AVR_ATmega328P__)
+void PCINT0_vect(void)       __attribute__((weak));
+void PCINT1_vect(void)       __attribute__((weak));
+void PCINT2_vect(void)       __attribute__((weak));
+void TIMER0_COMPA_vect(void) __attribute__((weak));
+void ADC_vect(void)          __attribute__((weak));
+#endif
+}
@@ -0,0 +1,414 @@
+#pragma once
+
+/*
+ * The register file, for host builds (see host.hpp)
+ *
+ * Every SFR the HAL touches is a plain `volatile` byte (C++17 inline
+ * variables, so there's nothing to link) starting out at its datasheet
+ * reset value. Nothing happens when they're written: host.hpp's Clock
+ * and Pins are what move TCNT0, set the interrupt flags and change PINx.
+ *
+ * The bit positions are the real ones for the MCU being emulated
+ * (__AVR_ATmega328P__ or __AVR_ATtiny85__, same as a target build).
+ */
+
+#include <stdint.h>
+
+#define _BV(bit) (1 << (bit))
+#define bit_is_set(sfr, bit)   ((sfr) & _BV(bit))
+#define bit_is_clear(sfr, bit) (!((sfr) & _BV(bit)))
+#define loop_until_bit_is_set(sfr, bit)   do { } while (bit_is_clear(sfr, bit))
+#define loop_until_bit_is_clear(sfr, bit) do { } while (bit_is_set(sfr, bit))
+
+#define HOST_SFR(name, reset)   inline volatile uint8_t  name { reset };
+#define HOST_SFR16(name, reset) inline volatile uint16_t name { reset };
+
+// status register
+HOST_SFR(SREG,   0x00)
+#define SREG_I 7
+
+// reset cause
+HOST_SFR(MCUSR,  0x00)
+#define WDRF  3
+#define BORF  2
+#define EXTRF 1
+#define PORF  0
+
+HOST_SFR(OSCCAL, 0x00)
+HOST_SFR(PRR,    0x00)
+HOST_SFR(MCUCR,  0x00)
+
+// port B
+HOST_SFR(DDRB,   0x00)
+HOST_SFR(PORTB,  0x00)
+HOST_SFR(PINB,   0x00)
+#define PB0 0
+#define PB1 1
+#define PB2 2
+#define PB3 3
+#define PB4 4
+#define PB5 5
+
+// Timer0
+HOST_SFR(TCCR0A, 0x00)
+HOST_SFR(TCCR0B, 0x00)
+HOST_SFR(TCNT0,  0x00)
+HOST_SFR(OCR0A,  0x00)
+HOST_SFR(OCR0B,  0x00)
+HOST_SFR(GTCCR,  0x00)
+#define COM0A1 7
+#define COM0A0 6
+#define COM0B1 5
+#define COM0B0 4
+#define WGM01  1
+#define WGM00  0
+#define FOC0A  7
+#define FOC0B  6
+#define WGM02  3
+#define CS02   2
+#define CS01   1
+#define CS00   0
+#define TSM    7
+
+// ADC (the parts both MCUs share)
+HOST_SFR(ADMUX,  0x00)
+HOST_SFR(ADCSRA, 0x00)
+HOST_SFR(ADCSRB, 0x00)
+HOST_SFR(DIDR0,  0x00)
+HOST_SFR16(ADCW,  0x0000)   // ADCL and ADCH in one
+#define ADC ADCW
+#define ADEN   7
+#define ADSC   6
+#define ADATE  5
+#define ADIF   4
+#define ADIE   3
+#define ADPS2  2
+#define ADPS1  1
+#define ADPS0  0
+#define ADTS2  2
+#define ADTS1  1
+#define ADTS0  0
+#define REFS1  7
+#define REFS0  6
+#define ADLAR  5
+#define MUX3   3
+#define MUX2   2
+#define MUX1   1
+#define MUX0   0
+#if defined(__AVR_ATtiny85__)
+#define REFS2  4
+#endif
+
+// watchdog, sleep, pin change interrupts
+#if defined(__AVR_ATtiny85__)
+
+HOST_SFR(WDTCR,  0x00)
+HOST_SFR(GIMSK,  0x00)
+HOST_SFR(GIFR,   0x00)
+HOST_SFR(PCMSK,  0x00)
+HOST_SFR(TIMSK,  0x00)
+HOST_SFR(TIFR,   0x00)
+
+#define WDIF   7
+#define WDIE   6
+#define WDP3   5
+#define WDCE   4
+#define WDE    3
+#define WDP2   2
+#define WDP1   1
+#define WDP0   0
+
+#define INT0   6
+#define PCIE   5
+#define INTF0  6
+#define PCIF   5
+
+#define BODS   7
+#define PUD    6
+#define SE     5
+#define SM1    4
+#define SM0    3
+#define BODSE  2
+#define ISC01  1
+#define ISC00  0
+
+#define OCIE1A 6
+#define OCIE1B 5
+#define OCIE0A 4
+#define OCIE0B 3
+#define TOIE1  2
+#define TOIE0  1
+#define OCF1A  6
+#define OCF1B  5
+#define OCF0A  4
+#define OCF0B  3
+#define TOV1   2
+#define TOV0   1
+
+#define PSR0   0
+
+#define PRTIM1 3
+#define PRTIM0 2
+#define PRUSI  1
+#define PRADC  0
+
+// Timer1 (8 bits, PLL clock)
+HOST_SFR(TCCR1,  0x00)
+HOST_SFR(TCNT1,  0x00)
+HOST_SFR(OCR1A,  0x00)
+HOST_SFR(OCR1B,  0x00)
+HOST_SFR(OCR1C,  0xFF)
+HOST_SFR(PLLCSR, 0x00)
+#define CTC1   7
+#define PWM1A  6
+#define COM1A1 5
+#define COM1A0 4
+#define CS13   3
+#define CS12   2
+#define CS11   1
+#define CS10   0
+#define PWM1B  6
+#define COM1B1 5
+#define COM1B0 4
+#define FOC1B  3
+#define FOC1A  2
+#define PSR1   1
+#define LSM    7
+#define PCKE   2
+#define PLLE   1
+#define PLOCK  0
+
+// USI
+HOST_SFR(USICR,  0x00)
+HOST_SFR(USISR,  0x00)
+HOST_SFR(USIDR,  0x00)
+HOST_SFR(USIBR,  0x00)
+#define USISIE 7
+#define USIOIE 6
+#define USIWM1 5
+#define USIWM0 4
+#define USICS1 3
+#define USICS0 2
+#define USICLK 1
+#define USITC  0
+#define USISIF 7
+#define USIOIF 6
+#define USIPF  5
+#define USIDC  4
+#define USICNT3 3
+#define USICNT2 2
+#define USICNT1 1
+#define USICNT0 0
+
+#elif defined(__AVR_ATmega328P__)
+
+HOST_SFR(DDRC,   0x00)
+HOST_SFR(PORTC,  0x00)
+HOST_SFR(PINC,   0x00)
+HOST_SFR(DDRD,   0x00)
+HOST_SFR(PORTD,  0x00)
+HOST_SFR(PIND,   0x00)
+#define PC0 0
+#define PC1 1
+#define PC2 2
+#define PC3 3
+#define PC4 4
+#define PC5 5
+#define PD0 0
+#define PD1 1
+#define PD2 2
+#define PD3 3
+#define PD4 4
+#define PD5 5
+#define PD6 6
+#define PD7 7
+
+HOST_SFR(WDTCSR, 0x00)
+HOST_SFR(SMCR,   0x00)
+HOST_SFR(PCICR,  0x00)
+HOST_SFR(PCIFR,  0x00)
+HOST_SFR(PCMSK0, 0x00)
+HOST_SFR(PCMSK1, 0x00)
+HOST_SFR(PCMSK2, 0x00)
+HOST_SFR(TIMSK0, 0x00)
+HOST_SFR(TIFR0,  0x00)
+
+#define WDIF   7
+#define WDIE   6
+#define WDP3   5
+#define WDCE   4
+#define WDE    3
+#define WDP2   2
+#define WDP1   1
+#define WDP0   0
+
+#define SM2    3
+#define SM1    2
+#define SM0    1
+#define SE     0
+
+#define BODS   6
+#define BODSE  5
+#define PUD    4
+
+#define PCIE2  2
+#define PCIE1  1
+#define PCIE0  0
+#define PCIF2  2
+#define PCIF1  1
+#define PCIF0  0
+
+#define OCIE0B 2
+#define OCIE0A 1
+#define TOIE0  0
+#define OCF0B  2
+#define OCF0A  1
+#define TOV0   0
+
+#define PSRASY  1
+#define PSRSYNC 0
+
+#define PRTWI    7
+#define PRTIM2   6
+#define PRTIM0   5
+#define PRTIM1   3
+#define PRSPI    2
+#define PRUSART0 1
+#define PRADC    0
+
+// Timer1 (16 bits)
+HOST_SFR(TCCR1A, 0x00)
+HOST_SFR(TCCR1B, 0x00)
+HOST_SFR(TCCR1C, 0x00)
+HOST_SFR16(TCNT1, 0x0000)
+HOST_SFR16(OCR1A, 0x0000)
+HOST_SFR16(OCR1B, 0x0000)
+HOST_SFR16(ICR1,  0x0000)
+HOST_SFR(TIMSK1, 0x00)
+HOST_SFR(TIFR1,  0x00)
+#define COM1A1 7
+#define COM1A0 6
+#define COM1B1 5
+#define COM1B0 4
+#define WGM11  1
+#define WGM10  0
+#define ICNC1  7
+#define ICES1  6
+#define WGM13  4
+#define WGM12  3
+#define CS12   2
+#define CS11   1
+#define CS10   0
+#define ICIE1  5
+#define OCIE1B 2
+#define OCIE1A 1
+#define TOIE1  0
+#define ICF1   5
+#define OCF1B  2
+#define OCF1A  1
+#define TOV1   0
+
+// Timer2
+HOST_SFR(TCCR2A, 0x00)
+HOST_SFR(TCCR2B, 0x00)
+HOST_SFR(TCNT2,  0x00)
+HOST_SFR(OCR2A,  0x00)
+HOST_SFR(OCR2B,  0x00)
+HOST_SFR(ASSR,   0x00)
+HOST_SFR(TIMSK2, 0x00)
+HOST_SFR(TIFR2,  0x00)
+#define COM2A1 7
+#define COM2A0 6
+#define COM2B1 5
+#define COM2B0 4
+#define WGM21  1
+#define WGM20  0
+#define FOC2A  7
+#define FOC2B  6
+#define WGM22  3
+#define CS22   2
+#define CS21   1
+#define CS20   0
+#define OCIE2B 2
+#define OCIE2A 1
+#define TOIE2  0
+#define OCF2B  2
+#define OCF2A  1
+#define TOV2   0
+
+// SPI
+HOST_SFR(SPCR,   0x00)
+HOST_SFR(SPSR,   0x00)
+HOST_SFR(SPDR,   0x00)
+#define SPIE   7
+#define SPE    6
+#define DORD   5
+#define MSTR   4
+#define CPOL   3
+#define CPHA   2
+#define SPR1   1
+#define SPR0   0
+#define SPIF   7
+#define WCOL   6
+#define SPI2X  0
+
+// TWI
+HOST_SFR(TWBR,   0x00)
+HOST_SFR(TWSR,   0xF8)
+HOST_SFR(TWAR,   0xFE)
+HOST_SFR(TWDR,   0xFF)
+HOST_SFR(TWCR,   0x00)
+HOST_SFR(TWAMR,  0x00)
+#define TWINT  7
+#define TWEA   6
+#define TWSTA  5
+#define TWSTO  4
+#define TWWC   3
+#define TWEN   2
+#define TWIE   0
+#define TWS7   7
+#define TWS6   6
+#define TWS5   5
+#define TWS4   4
+#define TWS3   3
+#define TWPS1  1
+#define TWPS0  0
+
+// USART0
+HOST_SFR(UCSR0A, 0x20)      // UDRE0 set: the transmitter is always ready
+HOST_SFR(UCSR0B, 0x00)
+HOST_SFR(UCSR0C, 0x06)
+HOST_SFR(UBRR0L, 0x00)
+HOST_SFR(UBRR0H, 0x00)
+HOST_SFR(UDR0,   0x00)
+#define RXC0   7
+#define TXC0   6
+#define UDRE0  5
+#define FE0    4
+#define DOR0   3
+#define UPE0   2
+#define U2X0   1
+#define MPCM0  0
+#define RXCIE0 7
+#define TXCIE0 6
+#define UDRIE0 5
+#define RXEN0  4
+#define TXEN0  3
+#define UCSZ02 2
+#define RXB80  1
+#define TXB80  0
+#define UMSEL01 7
+#define UMSEL00 6
+#define UPM01  5
+#define UPM00  4
+#define USBS0  3
+#define UCSZ01 2
+#define UCSZ00 1
+#define UCPOL0 0
+
+#else
+#error "Host builds emulate an ATtiny85 or an ATmega328P: define one of them"
+#endif
+
+#undef HOST_SFR
+#undef HOST_SFR16
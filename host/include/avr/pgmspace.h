@@ -0,0 +1,10 @@
+#pragma once
+
+// one address space on the host
+#include <stdint.h>
+
+#define PROGMEM
+#define PSTR(s) (s)
+#define pgm_read_byte(address)  (*reinterpret_cast<const uint8_t*>(address))
+#define pgm_read_word(address)  (*reinterpret_cast<const uint16_t*>(address))
+#define pgm_read_dword(address) (*reinterpret_cast<const uint32_t*>(address))
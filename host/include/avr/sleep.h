@@ -0,0 +1,23 @@
+#pragma once
+
+/*
+ * Sleeping returns straight away, as if an interrupt had woken the MCU
+ * up; host code decides what happened in the meantime (Clock::advance
+ * with Timer0 paused, say)
+ */
+
+#include <avr/io.h>
+
+#define SLEEP_MODE_IDLE       0
+#define SLEEP_MODE_ADC        1
+#define SLEEP_MODE_PWR_DOWN   2
+#define SLEEP_MODE_PWR_SAVE   3
+#define SLEEP_MODE_STANDBY    6
+#define SLEEP_MODE_EXT_STANDBY 7
+
+inline void set_sleep_mode(uint8_t) { }
+inline void sleep_enable()          { }
+inline void sleep_disable()         { }
+inline void sleep_cpu()             { }
+inline void sleep_mode()            { }
+inline void sleep_bod_disable()     { }
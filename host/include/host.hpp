@@ -0,0 +1,386 @@
+#pragma once
+
+#include "common.hpp"
+
+#include <stdint.h>
+#include <stdio.h>
+#include <chrono>
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include "gpio.hpp"
+#include "ticker.hpp"
+
+/**
+ * Running the HAL on the host
+ *
+ * host/include has stand-ins for the avr-libc headers: the SFRs are plain
+ * variables (avr/io.h), ISR() defines an ordinary function, and
+ * ATOMIC_BLOCK really does save, clear and restore the I bit in SREG. So
+ * the headers in include/ and src/ticker.cpp compile unchanged with g++
+ * (see host/Makefile; define the MCU to emulate as usual).
+ *
+ * Nothing happens by itself, though. This file is the "hardware":
+ *
+ *  - `Clock` moves Timer0 along: TCNT0 counts through the millisecond and
+ *    the compare match flag gets set (and its ISR, src/ticker.cpp's, run)
+ *    every millisecond, but only while TCCR0B has a clock selected, so
+ *    `HAL::Ticker::pause()` stops it like sleeping does.
+ *  - `Pins::set` drives a pin from the outside world: it changes PINx and,
+ *    if PCMSK has the pin, sets the pin change flag.
+ *  - `service()` runs every pending interrupt that's enabled (PCICR or
+ *    TIMSK, and the I bit), lowest vector first, with I cleared while
+ *    it runs. Clock and Pins call it, and so should code that just did a
+ *    `sei()` with something pending.
+ *
+ * and `replay()` plays a trace of edges into the pins in simulated time,
+ * running a "main loop" every so often in between, and measures how long
+ * (wall clock) the whole thing took
+ *
+        HAL::Devices::Button<14, 30, 1000, HIGH, true> btn;
+        ...
+        HAL::Host::Pins::setAll(HIGH);     // pull-ups
+        HAL::Ticker::setupMSTimer();
+        btn.begin();
+        sei();
+
+        HAL::Host::TraceFile trace("presses.txt");
+        auto stats = HAL::Host::replay(trace, [] { btn.process(); });
+ *
+ * A trace is anything with `bool next(Edge&)` handing out edges in time
+ * order: `TraceFile` reads recorded ones ("time_us pin level" per line),
+ * and `Bouncy` adds contact bounce to another source. host/replay.cpp
+ * runs the debouncer and the button and encoder classes through millions
+ * of generated edges that way and checks what they decode.
+ *
+ * Only what the HAL needs is emulated: writing PINx doesn't toggle PORTx,
+ * there are no pull-ups (set the idle level with `Pins::setAll`), and the
+ * Clock assumes the periodic 1 ms Ticker (tickless builds are refused).
+ * Sleeping returns straight away.
+ */
+
+#if defined(HAL_TICKER_TICKLESS)
+#error "The host Clock drives the periodic Ticker only"
+#endif
+
+namespace HAL {
+namespace Host {
+
+inline bool interruptsEnabled() {
+    return SREG & (1 << SREG_I);
+}
+
+// enter the way the hardware does (I cleared) and leave the way reti does
+inline void runISR(void (*vector)()) {
+    if (!vector) return;
+    SREG = SREG & ~(1 << SREG_I);
+    vector();
+    SREG = SREG | (1 << SREG_I);
+}
+
+#if defined(__AVR_ATtiny85__)
+inline volatile uint8_t& timer0Flags() { return TIFR;  }
+inline volatile uint8_t& timer0Mask()  { return TIMSK; }
+#elif defined(__AVR_ATmega328P__)
+inline volatile uint8_t& timer0Flags() { return TIFR0;  }
+inline volatile uint8_t& timer0Mask()  { return TIMSK0; }
+#endif
+
+// runs whatever is pending and enabled, in vector order
+inline void service() {
+    if (!interruptsEnabled()) return;
+#if defined(__AVR_ATtiny85__)
+    if ((GIFR & (1 << PCIF)) && (GIMSK & (1 << PCIE))) {
+        GIFR = GIFR & ~(1 << PCIF);
+        runISR(PCINT0_vect);
+    }
+    if ((TIFR & (1 << OCF0A)) && (TIMSK & (1 << OCIE0A))) {
+        TIFR = TIFR & ~(1 << OCF0A);
+        runISR(TIM0_COMPA_vect);
+    }
+#elif defined(__AVR_ATmega328P__)
+    void (*const pcintVectors[3])() = { PCINT0_vect, PCINT1_vect, PCINT2_vect };
+    for (uint8_t group = 0; group < 3; ++group) {
+        if ((PCIFR & (1 << group)) && (PCICR & (1 << group))) {
+            PCIFR = PCIFR & ~(1 << group);
+            runISR(pcintVectors[group]);
+        }
+    }
+    if ((TIFR0 & (1 << OCF0A)) && (TIMSK0 & (1 << OCIE0A))) {
+        TIFR0 = TIFR0 & ~(1 << OCF0A);
+        runISR(TIMER0_COMPA_vect);
+    }
+#endif
+}
+
+struct Clock {
+
+    static inline uint64_t totalUs    { 0 };  // however long the "MCU" has been up
+    static inline uint16_t usIntoTick { 0 };
+
+    // whether Timer0 is counting (Ticker::pause stops it)
+    static bool running() {
+        return TCCR0B & ((1 << CS02) | (1 << CS01) | (1 << CS00));
+    }
+
+    static void advanceMicros(uint32_t us) {
+        totalUs += us;
+        if (!running()) return;
+        while (us) {
+            uint32_t step = 1000 - usIntoTick;
+            if (step > us) step = us;
+            us         -= step;
+            usIntoTick += step;
+            if (usIntoTick == 1000) {
+                usIntoTick    = 0;
+                TCNT0         = 0;
+                timer0Flags() = timer0Flags() | (1 << OCF0A);
+                service();
+            } else {
+                TCNT0 = static_cast<uint8_t>(
+                        static_cast<uint32_t>(usIntoTick) * (OCR0A + 1) / 1000);
+            }
+        }
+    }
+
+    static void advance(uint32_t ms) {
+        while (ms--) advanceMicros(1000);
+    }
+
+    static void advanceTo(uint64_t us) {
+        while (totalUs < us) {
+            uint64_t left = us - totalUs;
+            advanceMicros(left > 1000000 ? 1000000 : static_cast<uint32_t>(left));
+        }
+    }
+
+    static uint64_t micros() { return totalUs; }
+};
+
+struct Pins {
+
+    static volatile uint8_t& pinRegister(HAL::GPIO::Port port) {
+        switch (port) {
+#if defined(__AVR_ATmega328P__)
+            case HAL::GPIO::Port::C: return PINC;
+            case HAL::GPIO::Port::D: return PIND;
+#endif
+            default:                 return PINB;
+        }
+    }
+
+    static volatile uint8_t& pcmskRegister(HAL::GPIO::Port port) {
+        switch (port) {
+#if defined(__AVR_ATtiny85__)
+            default:                 return PCMSK;
+#elif defined(__AVR_ATmega328P__)
+            case HAL::GPIO::Port::C: return PCMSK1;
+            case HAL::GPIO::Port::D: return PCMSK2;
+            default:                 return PCMSK0;
+#endif
+        }
+    }
+
+    static volatile uint8_t& pcintFlags() {
+#if defined(__AVR_ATtiny85__)
+        return GIFR;
+#elif defined(__AVR_ATmega328P__)
+        return PCIFR;
+#endif
+    }
+
+    static bool get(uint8_t physicalPin) {
+        const HAL::GPIO::PinInfo& info = HAL::GPIO::pinTable[physicalPin - 1];
+        return pinRegister(info.port) & (1 << info.bit);
+    }
+
+    // the outside world drives `physicalPin` to `level`
+    static void set(uint8_t physicalPin, bool level) {
+        const HAL::GPIO::PinInfo& info = HAL::GPIO::pinTable[physicalPin - 1];
+        if (info.port == HAL::GPIO::Port::Invalid) return;
+        volatile uint8_t& pin  = pinRegister(info.port);
+        uint8_t           mask = 1 << info.bit;
+        if (static_cast<bool>(pin & mask) == level) return;
+        pin = level ? (pin | mask) : (pin & ~mask);
+        // PCIFn/PCIF sit at the same bit as PCIEn/PCIE
+        if (pcmskRegister(info.port) & mask)
+            pcintFlags() = pcintFlags() | (1 << info.pcicrBit);
+        service();
+    }
+
+    // every input at `level`, without raising anything (the idle state)
+    static void setAll(bool level) {
+        uint8_t value = level ? 0xFF : 0x00;
+        PINB = value;
+#if defined(__AVR_ATmega328P__)
+        PINC = value;
+        PIND = value;
+#endif
+    }
+};
+
+struct Edge {
+    uint64_t atUs;    // simulated time
+    uint8_t  pin;     // physical pin
+    bool     level;
+};
+
+// xorshift32; seeded, so a failing run can be repeated
+struct Random {
+    uint32_t state;
+
+    explicit Random(uint32_t seed) : state { seed ? seed : 1 } { }
+
+    uint32_t next() {
+        state ^= state << 13;
+        state ^= state >> 17;
+        state ^= state << 5;
+        return state;
+    }
+
+    // 0 to n - 1
+    uint32_t below(uint32_t n) {
+        return static_cast<uint32_t>((static_cast<uint64_t>(next()) * n) >> 32);
+    }
+
+    uint32_t between(uint32_t low, uint32_t high) {
+        return low + below(high - low + 1);
+    }
+};
+
+// a recorded trace: "time_us pin level" per line, '#' starts a comment
+class TraceFile {
+
+    FILE* file;
+
+  public:
+    explicit TraceFile(const char* path)
+        : file { fopen(path, "r") } {
+    }
+
+    ~TraceFile() {
+        if (file) fclose(file);
+    }
+
+    TraceFile(const TraceFile&) = delete;
+    TraceFile& operator=(const TraceFile&) = delete;
+
+    bool ok() const { return file != nullptr; }
+
+    bool next(Edge& edge) {
+        if (!file) return false;
+        char line[128];
+        while (fgets(line, sizeof line, file)) {
+            unsigned long long at;
+            unsigned           pin, level;
+            if (line[0] == '#') continue;
+            if (sscanf(line, "%llu %u %u", &at, &pin, &level) == 3) {
+                edge = { at, static_cast<uint8_t>(pin), level != 0 };
+                return true;
+            }
+        }
+        return false;
+    }
+};
+
+/**
+ * Contact bounce on top of another source
+ *
+ * Every edge of `source` becomes 1 to 2 * maxBounces + 1 edges: the pin
+ * chatters between the new and the old level for up to `bounceUs` and
+ * then stays at the new one. The chatter is spread over [atUs,
+ * atUs + bounceUs), so the edges of `source` have to be further apart
+ * than that (on any pin) to stay in time order.
+ */
+template<typename Source>
+class Bouncy {
+
+    static constexpr uint8_t maxBounceLimit { 16 };
+
+    Source&  source;
+    Random&  random;
+    uint8_t  maxBounces;
+    uint32_t bounceUs;
+    Edge     pending[2 * maxBounceLimit + 1];
+    uint8_t  count;
+    uint8_t  index;
+
+  public:
+    Bouncy(Source& source, Random& random, uint8_t maxBounces, uint32_t bounceUs)
+        : source     { source },
+          random     { random },
+          maxBounces { maxBounces < maxBounceLimit ? maxBounces : maxBounceLimit },
+          bounceUs   { bounceUs },
+          pending    { },
+          count      { 0 },
+          index      { 0 } {
+    }
+
+    bool next(Edge& edge) {
+        if (index == count) {
+            Edge clean;
+            if (!source.next(clean)) return false;
+            uint8_t  bounces = random.below(maxBounces + 1);
+            uint8_t  n       = 2 * bounces + 1;
+            uint32_t slot    = bounceUs / n;
+            for (uint8_t i = 0; i < n; ++i) {
+                uint32_t jitter = slot ? random.below(slot) : 0;
+                pending[i] = { clean.atUs + i * slot + (i ? jitter : 0),
+                               clean.pin,
+                               (i & 1) ? !clean.level : clean.level };
+            }
+            count = n;
+            index = 0;
+        }
+        edge = pending[index++];
+        return true;
+    }
+};
+
+struct ReplayStats {
+    uint64_t edges;
+    uint64_t loops;
+    double   seconds;     // wall clock
+
+    double nsPerEdge() const { return edges ? seconds * 1e9 / edges : 0; }
+    double edgesPerSecond() const { return seconds > 0 ? edges / seconds : 0; }
+};
+
+/**
+ * Plays `source` into the pins: the Clock is moved up to each edge and
+ * `loop()` runs every `loopEveryUs` of simulated time in between, like a
+ * main loop would. `tailUs` more of looping at the end lets the last
+ * edges settle.
+ */
+template<typename Source, typename Loop>
+ReplayStats replay(Source& source, Loop&& loop,
+                   uint32_t loopEveryUs=1000, uint64_t tailUs=0) {
+    ReplayStats stats { 0, 0, 0 };
+    auto        start    = std::chrono::steady_clock::now();
+    uint64_t    nextLoop = Clock::micros() + loopEveryUs;
+    Edge        edge;
+
+    auto loopUntil = [&](uint64_t until) {
+        while (nextLoop <= until) {
+            Clock::advanceTo(nextLoop);
+            loop();
+            ++stats.loops;
+            nextLoop += loopEveryUs;
+        }
+    };
+
+    while (source.next(edge)) {
+        loopUntil(edge.atUs);
+        Clock::advanceTo(edge.atUs);
+        Pins::set(edge.pin, edge.level);
+        ++stats.edges;
+    }
+    loopUntil(Clock::micros() + tailUs);
+
+    stats.seconds = std::chrono::duration<double>(
+            std::chrono::steady_clock::now() - start).count();
+    return stats;
+}
+
+
+}
+}
@@ -0,0 +1,33 @@
+#pragma once
+
+/*
+ * Same construction as avr-libc's: save SREG, clear I, and put SREG back
+ * however the block is left
+ */
+
+#include <avr/io.h>
+
+static inline uint8_t host_iCliRetVal() {
+    SREG = SREG & ~(1 << SREG_I);
+    return 1;
+}
+
+static inline uint8_t host_iSeiRetVal() {
+    SREG = SREG | (1 << SREG_I);
+    return 1;
+}
+
+static inline void host_iRestore(const uint8_t* saved)    { SREG = *saved; }
+static inline void host_iSeiParam(const uint8_t*)         { SREG = SREG |  (1 << SREG_I); }
+static inline void host_iCliParam(const uint8_t*)         { SREG = SREG & ~(1 << SREG_I); }
+
+#define ATOMIC_RESTORESTATE    uint8_t host_sreg __attribute__((__cleanup__(host_iRestore)))  = SREG
+#define ATOMIC_FORCEON         uint8_t host_sreg __attribute__((__cleanup__(host_iSeiParam))) = 0
+#define NONATOMIC_RESTORESTATE uint8_t host_sreg __attribute__((__cleanup__(host_iRestore)))  = SREG
+#define NONATOMIC_FORCEOFF     uint8_t host_sreg __attribute__((__cleanup__(host_iCliParam))) = 0
+
+#define ATOMIC_BLOCK(type) \
+    for (type, host_todo = host_iCliRetVal(); host_todo; host_todo = 0)
+
+#define NONATOMIC_BLOCK(type) \
+    for (type, host_todo = host_iSeiRetVal(); host_todo; host_todo = 0)
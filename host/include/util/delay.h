@@ -0,0 +1,5 @@
+#pragma once
+
+// busy-waits take no (simulated) time on the host
+inline void _delay_ms(double) { }
+inline void _delay_us(double) { }
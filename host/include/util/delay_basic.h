@@ -0,0 +1,7 @@
+#pragma once
+
+#include <stdint.h>
+
+// busy-waits take no (simulated) time on the host
+inline void _delay_loop_1(uint8_t) { }
+inline void _delay_loop_2(uint16_t) { }
@@ -0,0 +1,268 @@
+/*
+ * Runs the debouncer, Button and the encoders through generated, bouncy
+ * edge traces on the host and checks what they decode
+ *
+ *      make -C host run            (or ./host/replay [scale] [seed])
+ *
+ * Every scenario knows what the clean trace should decode to; the bounce
+ * is random (seeded), and the timings stay inside what each class is
+ * specified to handle. Prints edges replayed, wall-clock cost per edge,
+ * and exits non-zero if anything decoded wrong.
+ */
+
+#include "avril.hpp"
+#include "host.hpp"
+#include "utils/IntTransitionDebouncer.hpp"
+#include "utils/PcintDispatcher.hpp"
+#include "devices/Button.hpp"
+#include "devices/RotaryEncoder.hpp"
+#include "devices/QuadratureEncoder.hpp"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+using HAL::Host::Edge;
+using HAL::Host::Random;
+
+// PD2, PD3
+HAL::Utils::IntTransitionDebouncer<4, 10, HIGH, true>        primeDebouncer;
+HAL::Utils::IntTransitionDebouncer<5, 10, HIGH, true, 64>    queuedDebouncer;
+// PB0
+HAL::Devices::Button<14, 30, 1000, HIGH, true, true, false,
+                     0, uint16_t, 250, 3>                    button;
+// PC0/PC1, PC2/PC3
+HAL::Devices::QuadratureEncoder<23, 24>                      quadrature;
+HAL::Devices::RotaryEncoder<25, 26, 5, HIGH, true>           rotary;
+
+using Pcint = HAL::Utils::PcintDispatcher<primeDebouncer, queuedDebouncer,
+                                          button, quadrature, rotary>;
+HAL_PCINT_DISPATCH(Pcint, 0)
+HAL_PCINT_DISPATCH(Pcint, 1)
+HAL_PCINT_DISPATCH(Pcint, 2)
+
+static bool allOK { true };
+
+static void report(const char* name, const HAL::Host::ReplayStats& stats, bool ok) {
+    printf("%-18s %9llu edges %10llu loops %8.1f ns/edge %7.2f Medges/s  %s\n",
+           name,
+           static_cast<unsigned long long>(stats.edges),
+           static_cast<unsigned long long>(stats.loops),
+           stats.nsPerEdge(),
+           stats.edgesPerSecond() / 1e6,
+           ok ? "ok" : "MISMATCH");
+    allOK = allOK && ok;
+}
+
+// one pin, toggling every minGapUs to maxGapUs
+struct Toggler {
+    Random&  random;
+    uint8_t  pin;
+    uint32_t minGapUs, maxGapUs;
+    uint32_t left;
+    bool     level { HIGH };
+    uint64_t at    { HAL::Host::Clock::micros() };
+
+    bool next(Edge& edge) {
+        if (!left) return false;
+        --left;
+        at   += random.between(minGapUs, maxGapUs);
+        level = !level;
+        edge  = { at, pin, level };
+        return true;
+    }
+};
+
+// groups of 1-3 clicks, or a long press, on an active-low button
+struct Gestures {
+    Random&  random;
+    uint8_t  pin;
+    uint32_t left;
+    uint64_t at { HAL::Host::Clock::micros() };
+
+    uint32_t expectedClicks[4] { };
+    uint32_t expectedLong      { 0 };
+    uint32_t expectedPresses   { 0 };
+
+    Edge    queue[6]   { };
+    uint8_t count { 0 }, index { 0 };
+
+    void press(uint32_t downMs, uint32_t gapMs) {
+        at += gapMs * 1000ULL;
+        queue[count++] = { at, pin, LOW };
+        at += downMs * 1000ULL;
+        queue[count++] = { at, pin, HIGH };
+        ++expectedPresses;
+    }
+
+    bool next(Edge& edge) {
+        if (index == count) {
+            if (!left) return false;
+            --left;
+            count = index = 0;
+            if (random.below(4) == 0) {
+                press(random.between(1200, 2500), random.between(600, 1000));
+                ++expectedLong;
+            } else {
+                uint8_t clicks = random.between(1, 3);
+                press(random.between(60, 150), random.between(600, 1000));
+                for (uint8_t i = 1; i < clicks; ++i)
+                    press(random.between(60, 150), random.between(80, 180));
+                ++expectedClicks[clicks];
+            }
+        }
+        edge = queue[index++];
+        return true;
+    }
+};
+
+// runs of detents one way or the other, CLK/DT per RotaryEncoder's CW
+struct Quadrature {
+    Random&  random;
+    uint8_t  clkPin, dtPin;
+    uint32_t minQuarterUs, maxQuarterUs;
+    uint32_t left;
+    uint64_t at { HAL::Host::Clock::micros() };
+
+    int32_t  expected { 0 };
+    uint32_t detents  { 0 };
+
+    int8_t  direction { 0 };
+    uint8_t runLeft   { 0 };
+    uint8_t quarter   { 0 };
+
+    bool next(Edge& edge) {
+        if (quarter == 0) {
+            if (!runLeft) {
+                if (!left) return false;
+                --left;
+                direction = random.below(2) ? +1 : -1;
+                runLeft   = random.between(1, 20);
+                at       += random.between(20000, 200000);
+            }
+            --runLeft;
+            expected += direction;
+            ++detents;
+        }
+        // CW: 11 -> 10 -> 00 -> 01 -> 11 (CLK, DT)
+        static const uint8_t cw[4][2]  = { { 1, 0 }, { 0, 0 }, { 0, 1 }, { 1, 1 } };
+        static const uint8_t ccw[4][2] = { { 0, 1 }, { 0, 0 }, { 1, 0 }, { 1, 1 } };
+        const uint8_t* state     = (direction > 0) ? cw[quarter] : ccw[quarter];
+        const uint8_t* previous  = (direction > 0) ? cw[(quarter + 3) & 3] : ccw[(quarter + 3) & 3];
+        bool           clkMoves  = state[0] != previous[0];
+        at   += random.between(minQuarterUs, maxQuarterUs);
+        edge  = { at, clkMoves ? clkPin : dtPin, clkMoves ? state[0] != 0 : state[1] != 0 };
+        quarter = (quarter + 1) & 3;
+        return true;
+    }
+};
+
+static void debouncers(Random& random, uint32_t scale) {
+    uint32_t rising { 0 }, falling { 0 };
+    auto count = [&](HAL::Transition t) {
+        if (t == HAL::Transition::RISING)  ++rising;
+        if (t == HAL::Transition::FALLING) ++falling;
+    };
+
+    // the main loop keeps up
+    {
+        Toggler toggler { random, 4, 20000, 200000, 100000 * scale };
+        HAL::Host::Bouncy<Toggler> bouncy { toggler, random, 8, 5000 };
+        auto stats = HAL::Host::replay(bouncy,
+                [&] { count(primeDebouncer.processAnyInterrupts()); }, 1000, 50000);
+        bool ok = rising + falling == 100000 * scale &&
+                  primeDebouncer.getStableState() == toggler.level;
+        report("debouncer", stats, ok);
+    }
+
+    // a main loop that only comes around every 50 ms; the queue keeps up
+    rising = falling = 0;
+    {
+        Toggler toggler { random, 5, 20000, 200000, 100000 * scale };
+        HAL::Host::Bouncy<Toggler> bouncy { toggler, random, 4, 5000 };
+        auto stats = HAL::Host::replay(bouncy, [&] {
+                    for (uint8_t i = 0; i < 8; ++i)
+                        count(queuedDebouncer.processAnyInterrupts());
+                }, 50000, 200000);
+        bool ok = rising + falling == 100000 * scale &&
+                  queuedDebouncer.getStableState() == toggler.level &&
+                  queuedDebouncer.droppedEvents() == 0;
+        report("debouncer (queued)", stats, ok);
+    }
+}
+
+static void buttons(Random& random, uint32_t scale) {
+    Gestures gestures { random, 14, 20000 * scale };
+    HAL::Host::Bouncy<Gestures> bouncy { gestures, random, 8, 5000 };
+
+    uint32_t clicks[4] { }, longPresses { 0 }, presses { 0 };
+    auto stats = HAL::Host::replay(bouncy, [&] {
+                switch (button.process()) {
+                    case HAL::ButtonAction::PRESS:      ++presses;     break;
+                    case HAL::ButtonAction::LONG_PRESS: ++longPresses; break;
+                    case HAL::ButtonAction::CLICK:
+                        if (button.getClickCount() <= 3) ++clicks[button.getClickCount()];
+                        break;
+                    default: break;
+                }
+            }, 1000, 1000000);
+
+    bool ok = presses     == gestures.expectedPresses &&
+              longPresses == gestures.expectedLong;
+    for (uint8_t i = 1; i <= 3; ++i) ok = ok && clicks[i] == gestures.expectedClicks[i];
+    report("button gestures", stats, ok);
+}
+
+static void encoders(Random& random, uint32_t scale) {
+    // fast spins: quarter steps 0.5 to 3 ms apart, 150 us of bounce
+    {
+        Quadrature steps { random, 23, 24, 500, 3000, 20000 * scale };
+        HAL::Host::Bouncy<Quadrature> bouncy { steps, random, 6, 150 };
+        int32_t sum { 0 };
+        auto stats = HAL::Host::replay(bouncy, [&] {
+                    quadrature.process();
+                    sum += quadrature.getDelta();
+                }, 1000, 10000);
+        bool ok = sum == steps.expected &&
+                  quadrature.getPosition() == static_cast<int16_t>(steps.expected);
+        report("quadrature", stats, ok);
+    }
+
+    // RotaryEncoder only debounces CLK, so it needs slow, clean-ish turns
+    {
+        Quadrature steps { random, 25, 26, 8000, 20000, 5000 * scale };
+        HAL::Host::Bouncy<Quadrature> bouncy { steps, random, 4, 1000 };
+        int32_t  net { 0 };
+        uint32_t detents { 0 };
+        auto stats = HAL::Host::replay(bouncy, [&] {
+                    switch (rotary.process()) {
+                        case HAL::RotaryEncoderAction::CW:  ++net; ++detents; break;
+                        case HAL::RotaryEncoderAction::CCW: --net; ++detents; break;
+                        default: break;
+                    }
+                }, 1000, 10000);
+        report("rotary", stats, net == steps.expected && detents == steps.detents);
+    }
+}
+
+int main(int argc, char** argv) {
+    uint32_t scale = (argc > 1) ? static_cast<uint32_t>(atoi(argv[1])) : 1;
+    uint32_t seed  = (argc > 2) ? static_cast<uint32_t>(atoi(argv[2])) : 1;
+    if (!scale) scale = 1;
+
+    HAL::Host::Pins::setAll(HIGH);
+    HAL::Ticker::setupMSTimer();
+    primeDebouncer.begin();
+    queuedDebouncer.begin();
+    button.begin();
+    quadrature.begin();
+    rotary.begin();
+    Pcint::begin();
+    sei();
+
+    Random random { seed };
+    debouncers(random, scale);
+    buttons(random, scale);
+    encoders(random, scale);
+
+    return allOK ? 0 : 1;
+}
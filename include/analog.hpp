@@ -0,0 +1,333 @@
+#pragma once
+
+#include "common.hpp"
+#include "utils/RingBuffer.hpp"
+
+#include <stdint.h>
+#include <util/atomic.h>
+#include <avr/io.h>
+#include <avr/sleep.h>
+#include <avr/interrupt.h>
+
+/**
+ * ANALOG
+ *
+ * The ADC, without polling ADSC in the main loop (avr-libc already
+ * #defines ADC, hence the name)
+ *
+ * Reference, prescaler and oversampling are template parameters, so the
+ * register values are worked out at compile time. The prescaler is the
+ * smallest one that keeps the ADC clock at or under `maxClockHz` (200 kHz
+ * is the fastest the datasheet promises full 10-bit resolution at).
+ *
+ * One-off conversions
+ *
+        using Adc = HAL::Analog::Converter<HAL::Analog::Reference::VCC>;
+        HAL_ANALOG_ISR(Adc)
+
+        Adc::begin();
+        uint16_t a = Adc::convert(0);               // busy-waits ~100 us
+        uint16_t b = Adc::convertSleeping(0);       // in ADC noise reduction
+        uint16_t c = Adc::convertOversampled<12>(0);
+ *
+ * `convertSleeping` puts the MCU in ADC noise reduction sleep, which
+ * starts the conversion, and returns once the conversion complete
+ * interrupt has woken it up; the CPU and the I/O clock (Timer0, so the
+ * ticker, ~100 us behind per conversion) are stopped meanwhile, which is
+ * what makes it quieter. Other interrupts wake it up early; it goes back
+ * to sleep until the conversion is done.
+ *
+ * `convertOversampled<bits>` adds up 4^(bits - 10) conversions and shifts
+ * the sum right by (bits - 10): 11 to 14 bits take 4 to 256 conversions.
+ * That only gains resolution if there's at least 1 LSB of noise on the
+ * input to average out.
+ *
+ * Sampling in the background
+ *
+        Adc::start<HAL::Analog::Trigger::FREE_RUNNING, 0, 1, 3>();
+        ...
+        HAL::Analog::Sample s;
+        while (Adc::read(s)) {
+            // s.channel, s.value
+        }
+ *
+ * The conversion complete ISR puts every result in a ring buffer of
+ * `bufferSize` samples, tagged with its channel, going round the listed
+ * channels (up to eight). With `extraBits` set, each channel is
+ * converted 4^extraBits times in a row and the decimated result is
+ * stored instead, so the buffer fills 4^extraBits times slower.
+ *
+ * FREE_RUNNING converts back to back (F_CPU / prescaler / 13 conversions
+ * a second: 9615 at 16 MHz). TICKER starts a conversion on every Timer0
+ * compare match, so once a millisecond with the default HAL::Ticker (and
+ * only at deadlines when it's tickless). When the buffer's full, new
+ * samples are dropped and counted (`droppedCount()`).
+ *
+ * `busy()` is true while sampling or converting, for HAL::Sleep::Governor
+ * (with Depth::ADC and PRADC kept on). Call `stop()` before the one-off
+ * conversions; they share the ADC and its interrupt with the sampler.
+ *
+ * To save power, disable the digital input buffers of the analog pins in
+ * DIDR0.
+ */
+
+namespace HAL {
+namespace Analog {
+
+// tiny85: AREF is PB0; 2.56 V is the tiny85's only
+enum class Reference : uint8_t { VCC, AREF, INTERNAL_1V1, INTERNAL_2V56 };
+
+enum class Trigger : uint8_t { FREE_RUNNING, TICKER };
+
+#if defined(__AVR_ATtiny85__)
+constexpr uint8_t BANDGAP     { 12 };
+constexpr uint8_t GROUND      { 13 };
+constexpr uint8_t TEMPERATURE { 15 };   // with Reference::INTERNAL_1V1
+#elif defined(__AVR_ATmega328P__)
+constexpr uint8_t TEMPERATURE { 8 };    // with Reference::INTERNAL_1V1
+constexpr uint8_t BANDGAP     { 14 };
+constexpr uint8_t GROUND      { 15 };
+#endif
+
+struct Sample {
+    uint8_t  channel;
+    uint16_t value;
+};
+
+static constexpr uint8_t getReferenceBits(Reference reference) {
+#if defined(__AVR_ATtiny85__)
+    switch (reference) {
+        case Reference::AREF:          return (1 << REFS0);
+        case Reference::INTERNAL_1V1:  return (1 << REFS1);
+        case Reference::INTERNAL_2V56: return (1 << REFS2) | (1 << REFS1);
+        default:                       return 0;
+    }
+#elif defined(__AVR_ATmega328P__)
+    switch (reference) {
+        case Reference::VCC:           return (1 << REFS0);
+        case Reference::INTERNAL_1V1:  return (1 << REFS1) | (1 << REFS0);
+        default:                       return 0;
+    }
+#endif
+}
+
+// ADPS bits for the smallest division (2 to 128) that gets F_CPU down to
+// at most maxClockHz
+static constexpr uint8_t getPrescalerBits(uint32_t maxClockHz) {
+    for (uint8_t bits = 1; bits < 7; ++bits) {
+        if ((F_CPU >> bits) <= maxClockHz) return bits;
+    }
+    return 7;
+}
+
+template<Reference reference=Reference::VCC,
+         uint8_t   bufferSize=16,
+         uint8_t   extraBits=0,
+         uint32_t  maxClockHz=200000>
+struct Converter {
+
+#if defined(__AVR_ATmega328P__)
+    static_assert(reference != Reference::INTERNAL_2V56,
+            "the ATmega328P has no 2.56 V reference");
+#endif
+    static_assert(extraBits <= 4, "oversampling gives at most 14 bits");
+    static_assert((F_CPU >> 7) <= maxClockHz,
+            "maxClockHz is below F_CPU / 128, the slowest the ADC can run");
+
+    static constexpr uint8_t referenceBits { getReferenceBits(reference) };
+    static constexpr uint8_t prescalerBits { getPrescalerBits(maxClockHz) };
+    static constexpr uint16_t runLength    { 1 << (2 * extraBits) };
+
+    static constexpr uint8_t idle    { 0xFF };
+    static constexpr uint8_t discard { 0xFE };
+
+    // up to 256 10-bit conversions need more than 16 bits
+    using Sum = typename Conditional<(extraBits > 3), uint32_t, uint16_t>::type;
+
+    static inline HAL::Utils::RingBuffer<Sample, bufferSize> samples;
+    static inline volatile uint8_t dropped   { 0 };
+
+    static inline uint8_t          channels[8] { };
+    static inline uint8_t          count       { 0 };
+    static inline bool             freeRunning { false };
+    static inline volatile uint8_t converting  { idle };   // index in channels
+    static inline volatile uint8_t upcoming    { idle };
+    static inline uint8_t          scheduled   { 0 };      // what schedule() hands out
+    static inline uint16_t         repeats     { 0 };
+    static inline Sum              sum         { 0 };
+    static inline uint16_t         summed      { 0 };
+
+    static inline volatile bool    single      { false };
+    static inline volatile bool    done        { false };
+    static inline volatile uint16_t result     { 0 };
+
+    static inline void setChannel(uint8_t channel) {
+        ADMUX = referenceBits | (channel & 0x0F);
+    }
+
+    static inline void begin() {
+        setChannel(0);
+        ADCSRA = (1 << ADEN) | (1 << ADIF) | prescalerBits;
+    }
+
+    static inline void end() {
+        stop();
+        ADCSRA = (1 << ADIF);
+    }
+
+    // index of the next conversion's channel, each one runLength times
+    static inline uint8_t schedule() {
+        uint8_t index = scheduled;
+        if (++repeats == runLength) {
+            repeats   = 0;
+            scheduled = (index + 1 < count) ? index + 1 : 0;
+        }
+        return index;
+    }
+
+    static inline void store(uint8_t index, uint16_t value) {
+        sum += value;
+        if (++summed < runLength) return;
+        Sample sample { channels[index], static_cast<uint16_t>(sum >> extraBits) };
+        sum    = 0;
+        summed = 0;
+        if (!samples.push(sample) && dropped < 0xFF) dropped = dropped + 1;
+    }
+
+    // call this (and only this) from ISR(ADC_vect)
+    static inline void onConversionComplete() {
+        uint16_t value = ADCW;
+        if (single) {
+            result = value;
+            single = false;
+            done   = true;
+            return;
+        }
+
+        uint8_t index = converting;
+        if (freeRunning) {
+            // the next conversion started with the ADMUX we set last
+            // time; this one picks the channel of the one after
+            converting = upcoming;
+            upcoming   = schedule();
+            setChannel(channels[upcoming]);
+        } else {
+            converting = schedule();
+            setChannel(channels[converting]);
+        }
+        if (index < count) store(index, value);
+    }
+
+    /**
+     * Starts sampling `chans` (in that order, round and round), throwing
+     * away anything still in the buffer
+     */
+    template<Trigger trigger, uint8_t... chans>
+    static void start() {
+        static_assert(sizeof...(chans) >= 1 && sizeof...(chans) <= 8,
+                "sample 1 to 8 channels");
+        stop();
+
+        const uint8_t list[] { chans... };
+        for (uint8_t i = 0; i < sizeof...(chans); ++i) channels[i] = list[i];
+        count       = sizeof...(chans);
+        freeRunning = (trigger == Trigger::FREE_RUNNING);
+        scheduled   = 0;
+        repeats     = 0;
+        sum         = 0;
+        summed      = 0;
+        samples.discard(samples.count());
+
+        ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+            uint8_t first = schedule();
+            setChannel(channels[first]);
+            if (freeRunning) {
+                // ADMUX can't change until the first conversion is under
+                // way, so the second one is on the same channel; the
+                // first (which takes longer anyway) is thrown away
+                converting = discard;
+                upcoming   = first;
+                ADCSRB     = 0;
+            } else {
+                converting = first;
+                upcoming   = idle;
+                ADCSRB     = (1 << ADTS1) | (1 << ADTS0);    // Timer0 compare A
+            }
+            ADCSRA = (1 << ADEN) | (1 << ADATE) | (1 << ADIF) | (1 << ADIE)
+                   | (freeRunning ? (1 << ADSC) : 0) | prescalerBits;
+        }
+    }
+
+    static void stop() {
+        ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+            ADCSRA = (ADCSRA & ~((1 << ADATE) | (1 << ADIE))) | (1 << ADIF);
+            converting = idle;
+            upcoming   = idle;
+            single     = false;
+        }
+        while (ADCSRA & (1 << ADSC)) { }
+    }
+
+    static inline bool read(Sample& sample) { return samples.pop(sample); }
+    static inline uint8_t available()       { return samples.count(); }
+
+    // samples lost to a full buffer (saturates at 255)
+    static inline uint8_t droppedCount()      { return dropped; }
+    static inline void    clearDroppedCount() { dropped = 0; }
+
+    static inline bool busy() {
+        return converting != idle || single || (ADCSRA & (1 << ADSC));
+    }
+
+    // blocking; the sampler must be stopped
+    static uint16_t convert(uint8_t channel) {
+        setChannel(channel);
+        ADCSRA |= (1 << ADSC);
+        while (ADCSRA & (1 << ADSC)) { }
+        return ADCW;
+    }
+
+    // the same, asleep in ADC noise reduction mode (needs HAL_ANALOG_ISR)
+    static uint16_t convertSleeping(uint8_t channel) {
+        setChannel(channel);
+        done   = false;
+        single = true;
+        ADCSRA = (ADCSRA & ~(1 << ADATE)) | (1 << ADIE) | (1 << ADIF);
+
+        set_sleep_mode(SLEEP_MODE_ADC);
+        cli();
+        while (!done) {
+            // entering the mode starts the conversion; the instruction
+            // after sei() runs before the interrupt can
+            sleep_enable();
+            sei();
+            sleep_cpu();
+            sleep_disable();
+            cli();
+        }
+        sei();
+        ADCSRA &= ~(1 << ADIE);
+        return result;
+    }
+
+    template<uint8_t bits, bool sleepingP=true>
+    static uint16_t convertOversampled(uint8_t channel) {
+        static_assert(bits >= 10 && bits <= 14, "10 to 14 bits");
+        constexpr uint8_t  extra { bits - 10 };
+        constexpr uint16_t n     { 1 << (2 * extra) };
+
+        uint32_t total { 0 };
+        for (uint16_t i = 0; i < n; ++i)
+            total += sleepingP ? convertSleeping(channel) : convert(channel);
+        return static_cast<uint16_t>(total >> extra);
+    }
+};
+
+#define HAL_ANALOG_ISR(Adc)                   \
+    ISR(ADC_vect) {                           \
+        Adc::onConversionComplete();          \
+    }
+
+
+}
+}
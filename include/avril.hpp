@@ -8,4 +8,9 @@
 #include "sleep.hpp"
 #include "ticker.hpp"
 #include "uart.hpp"
+#include "analog.hpp"
+#include "pwm.hpp"
+#include "softpwm.hpp"
+#include "spi.hpp"
+#include "i2c.hpp"
 
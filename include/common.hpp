@@ -1,6 +1,7 @@
 #pragma once
 
 #if !defined(__AVR_ATtiny85__) && !defined(__AVR_ATmega328P__)
+// host builds (host/) define one of these too, to pick the register file
 #error "Unsupported MCU: This code only supports ATtiny85 and ATmega328P."
 #endif
 
@@ -9,6 +10,17 @@ constexpr bool LOW  { false };
 
 using Callback = void (*)();
 
+namespace HAL {
+
+// no <type_traits> on avr-gcc
+template<bool condition, typename T, typename F>
+struct Conditional { using type = T; };
+
+template<typename T, typename F>
+struct Conditional<false, T, F> { using type = F; };
+
+}
+
 #define READ_VOLATILE_U32(var, dest)   \
     ATOMIC_BLOCK(ATOMIC_RESTORESTATE) { \
         (dest) = (var);                 \
@@ -13,57 +13,256 @@
  *  TODO  add documentation
  */
 
-/*
- *  TODO  double click? how
- */
-
-/*
- *  TODO  make a VERY long press
+/**
+ * Gestures
+ *
+ * Besides PRESS, RELEASE and LONG_PRESS, `process()` can recognise
+ *
+ *  - N clicks: with a `clickWindow`, every reported release starts (or
+ *    extends) a window; when it runs out without another press, or after
+ *    `maxClicks` clicks, CLICK is returned and `getClickCount()` says how
+ *    many there were (1 for a single click, 2 for a double, ...). A press
+ *    that turns into a long press isn't a click and cancels the count.
+ *  - a very long press: VERY_LONG_PRESS, `veryLongPressWaitTime` after the
+ *    press (after LONG_PRESS, which still comes first)
+ *  - hold-repeat: with a `repeatInterval`, REPEAT every `repeatInterval`
+ *    ticks after LONG_PRESS for as long as the button is held
+ *
+        // 250 ms between clicks, up to triple clicks, 3 s very long
+        // press, repeat every 100 ms after the 1 s long press
+        HAL::Devices::Button<14, 30, 1000, HIGH, true, true, false,
+                             0, uint16_t, 250, 3, 3000, 100> btn;
+ *
+ * All of them are off by default (a window of 0). PRESS and RELEASE are
+ * still reported as they happen, so CLICK comes on top of them, one
+ * window after the last release. It's all done with the tick count
+ * `process()` already reads and a couple of timestamps; the deadlines are
+ * passed to `HAL::Ticker::requestWakeAt` like the long press one.
+ *
+ * Each gesture's state and callback only exist when it's switched on
+ * (the same trick as the debouncer's TransitionCallbacks), so a Button
+ * without them is no bigger than it used to be.
  */
 
 namespace HAL {
 
-enum class ButtonAction : uint8_t { NONE, RELEASE, PRESS, LONG_PRESS };
+enum class ButtonAction : uint8_t {
+    NONE,
+    RELEASE,
+    PRESS,
+    LONG_PRESS,
+    VERY_LONG_PRESS,
+    REPEAT,
+    CLICK
+};
 
 namespace Devices {
 
+// the gestures' state, each empty when the gesture is off
+template<bool clicksP>
+struct ClickState {
+    uint8_t  clicks     { 0 };
+    uint8_t  clickCount { 0 };
+    Callback onClick    { nullptr };
+};
+
+template<>
+struct ClickState<false> { };
+
+// last LONG_PRESS or REPEAT, for repeats and consecutive long presses
+template<bool refireP, typename Stamp>
+struct RefireState {
+    Stamp lastFired { 0 };
+};
+
+template<typename Stamp>
+struct RefireState<false, Stamp> { };
+
+template<bool veryLongPressP>
+struct VeryLongPressCallback {
+    Callback onVeryLongPress { nullptr };
+};
+
+template<>
+struct VeryLongPressCallback<false> { };
+
+template<bool repeatP>
+struct RepeatCallback {
+    Callback onRepeat { nullptr };
+};
+
+template<>
+struct RepeatCallback<false> { };
+
 template<uint8_t  physicalPin,
          uint32_t debounceWaitTime,
          uint32_t longPressWaitTime,
          bool     passiveState,
          bool     usePullupP,
          bool     supressReleaseAfterLongPress=true,
-         bool     allowConsecutiveLongPresses=false>
-class Button {
-
-    HAL::GPIO::GPIO<physicalPin> gpio;
-    HAL::Utils::IntTransitionDebouncer<physicalPin,
-                                       debounceWaitTime,
-                                       passiveState,
-                                       usePullupP> debouncer;
-    uint32_t lastPressed;
-    bool     suppressNextRelease;
-    bool     longPressLockoutP;
-    Callback onRelease;
-    Callback onPress;
-    Callback onLongPress;
+         bool     allowConsecutiveLongPresses=false,
+         uint8_t  eventQueueSize=0,
+         typename Stamp=uint32_t,
+         uint32_t clickWindow=0,
+         uint8_t  maxClicks=3,
+         uint32_t veryLongPressWaitTime=0,
+         uint32_t repeatInterval=0>
+class Button : private ClickState<(clickWindow > 0)>,
+               private RefireState<(repeatInterval > 0 || allowConsecutiveLongPresses), Stamp>,
+               private VeryLongPressCallback<(veryLongPressWaitTime > 0)>,
+               private RepeatCallback<(repeatInterval > 0)> {
+
+    using Debouncer = HAL::Utils::IntTransitionDebouncer<physicalPin,
+                                                         debounceWaitTime,
+                                                         passiveState,
+                                                         usePullupP,
+                                                         eventQueueSize,
+                                                         Stamp,
+                                                         false>;
+    using Pin       = HAL::GPIO::GPIO<physicalPin>;
+
+    static constexpr bool fitsP(uint32_t window) {
+        return window < (1ULL << (8 * sizeof(Stamp)));
+    }
+
+    static_assert(fitsP(longPressWaitTime) && fitsP(clickWindow) &&
+                  fitsP(veryLongPressWaitTime) && fitsP(repeatInterval),
+            "the time windows have to fit in the timestamp type");
+    static_assert(veryLongPressWaitTime == 0 || veryLongPressWaitTime > longPressWaitTime,
+            "a very long press has to be longer than a long press");
+    static_assert(maxClicks > 0, "maxClicks must be at least 1");
+
+    // kept in the debouncer's spare flag bits
+    static constexpr uint8_t SUPPRESS_NEXT_RELEASE { Debouncer::firstOwnerFlag     };
+    static constexpr uint8_t LONG_PRESS_FIRED      { Debouncer::firstOwnerFlag + 1 };
+    static constexpr uint8_t VERY_LONG_PRESS_FIRED { Debouncer::firstOwnerFlag + 2 };
+    static constexpr uint8_t CLICK_DUE             { Debouncer::firstOwnerFlag + 3 };
+
+    static constexpr bool clicksP { clickWindow > 0 };
+
+    Debouncer debouncer;
+    Stamp     lastPressed;      // or released, while the button is up
+    Callback  onRelease;
+    Callback  onPress;
+    Callback  onLongPress;
+
+    static Stamp since(uint32_t now, Stamp then) {
+        return static_cast<Stamp>(static_cast<Stamp>(now) - then);
+    }
+
+    bool flag(uint8_t bit) { return debouncer.getOwnerFlag(bit); }
+    void setFlag(uint8_t bit, bool value) { debouncer.setOwnerFlag(bit, value); }
+
+    // the click sequence is over; report it on this or the next call
+    void endClicks() {
+        this->clickCount = this->clicks;
+        this->clicks     = 0;
+        setFlag(CLICK_DUE, true);
+    }
+
+    bool clicking() {
+        if constexpr (clicksP) return this->clicks != 0;
+        else return false;
+    }
+
+    void press(uint32_t now) {
+        if constexpr (clickWindow > 0) {
+            // the window ran out before we got to look
+            if (this->clicks && since(now, lastPressed) >= clickWindow) endClicks();
+        }
+        lastPressed = static_cast<Stamp>(now);
+        setFlag(LONG_PRESS_FIRED, false);
+        setFlag(VERY_LONG_PRESS_FIRED, false);
+        HAL::Ticker::requestWakeAt(now + longPressWaitTime);
+    }
+
+    // true if the release should be reported
+    bool release(uint32_t now) {
+        bool wasLongP = flag(LONG_PRESS_FIRED);
+        setFlag(LONG_PRESS_FIRED, false);
+        setFlag(VERY_LONG_PRESS_FIRED, false);
+        if constexpr (clickWindow > 0) {
+            if (!wasLongP) {
+                lastPressed = static_cast<Stamp>(now);
+                if (++this->clicks >= maxClicks) endClicks();
+                else HAL::Ticker::requestWakeAt(now + clickWindow);
+            }
+        }
+        if (supressReleaseAfterLongPress && flag(SUPPRESS_NEXT_RELEASE)) {
+            setFlag(SUPPRESS_NEXT_RELEASE, false);
+            return false;
+        }
+        return true;
+    }
+
+    ButtonAction whileHeld(uint32_t now) {
+        Stamp held = since(now, lastPressed);
+
+        if (!flag(LONG_PRESS_FIRED)) {
+            if (held < longPressWaitTime) return ButtonAction::NONE;
+            setFlag(LONG_PRESS_FIRED, true);
+            setFlag(SUPPRESS_NEXT_RELEASE, true);
+            if constexpr (clicksP) this->clicks = 0;
+            if constexpr (repeatInterval > 0 || allowConsecutiveLongPresses)
+                this->lastFired = static_cast<Stamp>(now);
+            if constexpr (veryLongPressWaitTime > 0) {
+                // process() may be running late: then it's due right away
+                Stamp left = (held < veryLongPressWaitTime) ? veryLongPressWaitTime - held : 0;
+                HAL::Ticker::requestWakeAt(now + left);
+            }
+            if constexpr (repeatInterval > 0)
+                HAL::Ticker::requestWakeAt(now + repeatInterval);
+            else if constexpr (allowConsecutiveLongPresses)
+                HAL::Ticker::requestWakeAt(now + longPressWaitTime);
+            if (onLongPress) onLongPress();
+            return ButtonAction::LONG_PRESS;
+        }
+
+        // only once LONG_PRESS is out, even if both are due
+        if constexpr (veryLongPressWaitTime > 0) {
+            if (!flag(VERY_LONG_PRESS_FIRED) && held >= veryLongPressWaitTime) {
+                setFlag(VERY_LONG_PRESS_FIRED, true);
+                setFlag(SUPPRESS_NEXT_RELEASE, true);
+                if (this->onVeryLongPress) this->onVeryLongPress();
+                return ButtonAction::VERY_LONG_PRESS;
+            }
+        }
+
+        if constexpr (repeatInterval > 0) {
+            if (since(now, this->lastFired) >= repeatInterval) {
+                this->lastFired = static_cast<Stamp>(now);
+                HAL::Ticker::requestWakeAt(now + repeatInterval);
+                if (this->onRepeat) this->onRepeat();
+                return ButtonAction::REPEAT;
+            }
+        } else if constexpr (allowConsecutiveLongPresses) {
+            if (since(now, this->lastFired) >= longPressWaitTime) {
+                this->lastFired = static_cast<Stamp>(now);
+                HAL::Ticker::requestWakeAt(now + longPressWaitTime);
+                if (onLongPress) onLongPress();
+                return ButtonAction::LONG_PRESS;
+            }
+        }
+        return ButtonAction::NONE;
+    }
 
   public:
     Button()
-        : gpio                { },
-          debouncer           { },
-          lastPressed         { 0 },
-          suppressNextRelease { false },
-          longPressLockoutP   { false },
-          onRelease           { nullptr },
-          onPress             { nullptr },
-          onLongPress         { nullptr } {
+        : debouncer   { },
+          lastPressed { 0 },
+          onRelease   { nullptr },
+          onPress     { nullptr },
+          onLongPress { nullptr } {
     }
 
     void begin() {
         debouncer.begin();
     }
 
+    static constexpr uint8_t pcintMask(uint8_t pcicrBit) {
+        return Debouncer::pcintMask(pcicrBit);
+    }
+
     void notifyInterruptOccurred(uint32_t now, uint8_t changed) {
         debouncer.notifyInterruptOccurred(now, changed);
     }
@@ -72,74 +271,82 @@ class Button {
     void setOnPress(Callback fnptr)     {     onPress = fnptr; }
     void setOnLongPress(Callback fnptr) { onLongPress = fnptr; }
 
+    void setOnVeryLongPress(Callback fnptr) {
+        static_assert(veryLongPressWaitTime > 0, "this Button has no very long press");
+        this->onVeryLongPress = fnptr;
+    }
+
+    void setOnRepeat(Callback fnptr) {
+        static_assert(repeatInterval > 0, "this Button has no hold-repeat");
+        this->onRepeat = fnptr;
+    }
+
+    void setOnClick(Callback fnptr) {
+        static_assert(clicksP, "this Button has no click window");
+        this->onClick = fnptr;
+    }
+
     bool getStableState() {
         return debouncer.getStableState();
     }
 
     bool getNowState() {
-        return gpio.read();
+        return Pin::read();
+    }
+
+    // how many clicks the last CLICK was
+    uint8_t getClickCount() {
+        if constexpr (clicksP) return this->clickCount;
+        else return 0;
     }
 
     ButtonAction process() {
         Transition btnTransition { debouncer.processAnyInterrupts() };
-        ButtonAction btnAction   { ButtonAction::NONE };
-        uint32_t     now         { HAL::Ticker::getNumTicks() };
-        bool         nowState    { gpio.read() };
-        bool         stableState { debouncer.getStableState() };
+        uint32_t   now           { HAL::Ticker::getNumTicks() };
 
         if (btnTransition == Transition::NONE) {
-            if (nowState == stableState && nowState!=passiveState) {
-                if (((now - lastPressed) >= longPressWaitTime)) {
-                    if (!allowConsecutiveLongPresses && longPressLockoutP) {
-                        return ButtonAction::NONE;
-                    }
-                    lastPressed = now; // HERE?!
-                    suppressNextRelease = true;
-                    longPressLockoutP = true;
-                    if (onLongPress) onLongPress();
-                    return ButtonAction::LONG_PRESS;
+            if constexpr (clickWindow > 0) {
+                if (this->clicks && debouncer.getStableState() == passiveState &&
+                        since(now, lastPressed) >= clickWindow) {
+                    endClicks();
                 }
-            }
-        }
-
-        //  TODO  refactor this bs
-        else if (btnTransition == Transition::FALLING) {
-            if (passiveState) {
-                lastPressed = now;
-                if (onPress) onPress();
-                btnAction = ButtonAction::PRESS;
-            } else {
-                longPressLockoutP = false;
-                if (supressReleaseAfterLongPress && suppressNextRelease) {
-                    suppressNextRelease = false;
-                } else {
-                    if (onRelease) onRelease();
-                    btnAction =  ButtonAction::RELEASE;
-                }
-
-            }
-        } else if (btnTransition == Transition::RISING) {
-            if (passiveState) {
-                longPressLockoutP = false;
-                if (supressReleaseAfterLongPress && suppressNextRelease) {
-                    suppressNextRelease = false;
-                } else {
-                    if (onRelease) onRelease();
-                    btnAction =  ButtonAction::RELEASE;
+                if (flag(CLICK_DUE)) {
+                    setFlag(CLICK_DUE, false);
+                    if (this->onClick) this->onClick();
+                    return ButtonAction::CLICK;
                 }
-            } else {
-                if (onPress) onPress();
-                btnAction = ButtonAction::PRESS;
             }
+            bool nowState    { Pin::read() };
+            bool stableState { debouncer.getStableState() };
+            if (nowState == stableState && nowState!=passiveState)
+                return whileHeld(now);
+            return ButtonAction::NONE;
         }
 
-        return btnAction;
+        bool pressed = (btnTransition == Transition::FALLING) == passiveState;
+        if (pressed) {
+            press(now);
+            if (onPress) onPress();
+            return ButtonAction::PRESS;
+        }
+        if (release(now)) {
+            if (onRelease) onRelease();
+            return ButtonAction::RELEASE;
+        }
+        return ButtonAction::NONE;
     }
 
 
+    // edges lost to a full event queue (see IntTransitionDebouncer)
+    uint8_t droppedEvents() {
+        return debouncer.droppedEvents();
+    }
+
+    // also true while held (long press timing) or in a click window
     bool pendingDebounceTimeout() {
-        //  TODO  AND IF HELD DOWN!
-        return debouncer.pendingDebounceTimeout() || !debouncer.getStableState();
+        return debouncer.pendingDebounceTimeout() ||
+               debouncer.getStableState() != passiveState ||
+               clicking() || flag(CLICK_DUE);
     }
 
 };
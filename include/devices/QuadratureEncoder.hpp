@@ -0,0 +1,249 @@
+#pragma once
+
+#include "common.hpp"
+
+#include <stdint.h>
+#include <avr/pgmspace.h>
+#include <util/atomic.h>
+#include "gpio.hpp"
+#include "ticker.hpp"
+#include "RotaryEncoder.hpp"
+
+/**
+ * Full-quadrature rotary encoder decoder
+ *
+ * RotaryEncoder debounces CLK and looks at DT on its falling edge. This
+ * one instead follows both pins through the Gray code
+ *
+            CW:   11 -> 10 -> 00 -> 01 -> 11   (CLK, DT; pull-ups)
+ *
+ * with a 16-entry transition table (indexed by the previous and current
+ * state) in the pin change ISR. A legal move is +1 or -1 quarter step,
+ * "no change" and "both pins changed" (which can't happen and so must be
+ * noise) are 0. Contact bounce shows up as a step forward and a step
+ * back, which cancel, so there's no time-based debounce at all.
+ * Clockwise is the direction RotaryEncoder calls CW.
+ *
+ * A detent is counted when the encoder comes to rest at least half a
+ * detent's worth of quarter steps away from the last one (rest is both
+ * pins passive for a 4-step-per-detent encoder, both pins equal for a
+ * 2-step one); the quarter-step count is re-aligned there, so a missed
+ * transition can't put every later detent off by one.
+ *
+        HAL::Devices::QuadratureEncoder<23, 24> enc;
+        ...
+        enc.begin();    // and list it in a PcintDispatcher (or call
+                        // notifyInterruptOccurred from your PCINT ISR)
+        ...
+        if (enc.process() != HAL::RotaryEncoderAction::NONE)
+            volume += enc.getAcceleratedDelta();
+ *
+ * `process()` reports everything that happened since the previous call
+ * at once: the signed number of detents (`getDelta()`), the running
+ * position (`getPosition()`, wraps at 16 bits) and the speed
+ * (`getVelocity()`, detents per second, from the time between the last
+ * two detents or the time since the last one, whichever is longer, so it
+ * decays when the knob stops). `onCW`/`onCCW` get called once per
+ * `process()` that saw movement, not once per detent, so a fast spin
+ * doesn't flood them; the callbacks read `getDelta()` for how far.
+ *
+ * ACCELERATION
+ *
+ * With `accelBelowMs` and `accelMax` set
+ *
+        HAL::Devices::QuadratureEncoder<23, 24, HIGH, true, 4, false, 50, 10> enc;
+ *
+ * detents that come faster than one per 50 ticks get multiplied by up to
+ * 10 in `getAcceleratedDelta()`, ramping up linearly as the time between
+ * detents goes to zero. The defaults (0 and 1) switch it off.
+ *
+ * Ticks are HAL::Ticker ticks, so the times are milliseconds with the
+ * default Ticker. Both pins need PCINT (they may be on different ports).
+ */
+
+namespace HAL {
+namespace Devices {
+
+// +1 is a quarter step clockwise, indexed by (previous << 2) | current
+// with CLK as the high bit
+inline const int8_t quadratureTable[16] PROGMEM = {
+     0, +1, -1,  0,
+    -1,  0,  0, +1,
+    +1,  0,  0, -1,
+     0, -1, +1,  0
+};
+
+template<uint8_t  clkPin,
+         uint8_t  dtPin,
+         bool     passiveState=HIGH,
+         bool     usePullupP=true,
+         uint8_t  stepsPerDetent=4,
+         bool     reverseP=false,
+         uint16_t accelBelowMs=0,
+         uint8_t  accelMax=1>
+class QuadratureEncoder {
+
+    static_assert(stepsPerDetent == 1 || stepsPerDetent == 2 || stepsPerDetent == 4,
+            "stepsPerDetent must be 1, 2 or 4");
+    static_assert(accelMax >= 1, "accelMax is a factor, 1 means no acceleration");
+
+    using CLK = HAL::GPIO::GPIO<clkPin>;
+    using DT  = HAL::GPIO::GPIO<dtPin>;
+
+    static constexpr uint8_t restState { passiveState ? 0b11 : 0b00 };
+    static constexpr int8_t  threshold { (stepsPerDetent + 1) / 2 };
+
+    static constexpr uint16_t noInterval { 0xFFFF };
+
+    // ISR side
+    volatile uint8_t  previous;
+    volatile int8_t   quarterSteps;
+    volatile int8_t   lastDirection;
+    volatile int16_t  position;
+    volatile uint32_t lastDetentAt;
+    volatile uint16_t detentInterval;    // ticks between the last two
+
+    // main loop side
+    int16_t  lastPosition;
+    int16_t  delta;
+    uint16_t period;
+    Callback onCW;
+    Callback onCCW;
+
+    static uint8_t readState() {
+        return (CLK::read() ? 0b10 : 0) | (DT::read() ? 0b01 : 0);
+    }
+
+    static constexpr bool atRest(uint8_t state) {
+        if constexpr (stepsPerDetent == 4) return state == restState;
+        if constexpr (stepsPerDetent == 2) return state == 0b00 || state == 0b11;
+        return true;
+    }
+
+    void detent(uint32_t now, int8_t direction) {
+        uint32_t since = now - lastDetentAt;
+        // the first detent after changing direction has no speed yet
+        detentInterval = (direction == lastDirection && since < noInterval)
+                       ? static_cast<uint16_t>(since) : noInterval;
+        lastDirection  = direction;
+        lastDetentAt   = now;
+        position       = position + direction;
+    }
+
+  public:
+    QuadratureEncoder()
+        : previous       { restState  },
+          quarterSteps   { 0          },
+          lastDirection  { 0          },
+          position       { 0          },
+          lastDetentAt   { 0          },
+          detentInterval { noInterval },
+          lastPosition   { 0          },
+          delta          { 0          },
+          period         { noInterval },
+          onCW           { nullptr    },
+          onCCW          { nullptr    } {
+    }
+
+    void begin() {
+        if constexpr (usePullupP) {
+            CLK::setInputPullup();
+            DT::setInputPullup();
+        } else {
+            CLK::setInput();
+            DT::setInput();
+        }
+        previous = readState();
+        CLK::enablePCINT();
+        DT::enablePCINT();
+    }
+
+    static constexpr uint8_t pcintMask(uint8_t pcicrBit) {
+        return ((CLK::info.pcicrBit == pcicrBit) ? CLK::mask : 0)
+             | ((DT::info.pcicrBit  == pcicrBit) ? DT::mask  : 0);
+    }
+
+    // call from the PCINT ISR(s) of both pins
+    void notifyInterruptOccurred(uint32_t now, uint8_t changed) {
+        uint8_t state = readState();
+        uint8_t prev  = previous;
+        if (state == prev) return;
+        previous = state;
+
+        int8_t step = static_cast<int8_t>(
+                pgm_read_byte(&quadratureTable[(prev << 2) | state]));
+        int8_t q = quarterSteps + (reverseP ? -step : step);
+
+        if (atRest(state)) {
+            if      (q >=  threshold) detent(now, +1);
+            else if (q <= -threshold) detent(now, -1);
+            q = 0;
+        }
+        quarterSteps = q;
+    }
+
+    void setOnCW(Callback fnptr)  {  onCW = fnptr; }
+    void setOnCCW(Callback fnptr) { onCCW = fnptr; }
+
+    // everything since the previous call; see getDelta() for how far
+    RotaryEncoderAction process() {
+        int16_t  pos;
+        uint16_t interval;
+        uint32_t since;
+        ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+            pos      = position;
+            interval = detentInterval;
+            since    = HAL::Ticker::getNumTicks() - lastDetentAt;
+        }
+        delta        = static_cast<int16_t>(pos - lastPosition);
+        lastPosition = pos;
+        period       = (since >= interval) ? (since < noInterval
+                                                  ? static_cast<uint16_t>(since)
+                                                  : noInterval)
+                                           : interval;
+
+        if (delta > 0) {
+            if (onCW) onCW();
+            return RotaryEncoderAction::CW;
+        }
+        if (delta < 0) {
+            if (onCCW) onCCW();
+            return RotaryEncoderAction::CCW;
+        }
+        return RotaryEncoderAction::NONE;
+    }
+
+    // detents between the last two process() calls, + is clockwise
+    int16_t getDelta() { return delta; }
+
+    int16_t getPosition() { return lastPosition; }
+
+    // detents per second as of the last process()
+    uint16_t getVelocity() {
+        if (period == noInterval) return 0;
+        if (period == 0) return 1000;
+        return 1000 / period;
+    }
+
+    // getDelta() scaled up by the acceleration curve
+    int16_t getAcceleratedDelta() {
+        if constexpr (accelMax == 1 || accelBelowMs == 0) {
+            return delta;
+        } else {
+            if (period >= accelBelowMs) return delta;
+            uint16_t factor = 1 + static_cast<uint32_t>(accelMax - 1)
+                                  * (accelBelowMs - period) / accelBelowMs;
+            return static_cast<int16_t>(delta * static_cast<int16_t>(factor));
+        }
+    }
+
+    // nothing is ever waiting on a timeout
+    bool pendingDebounceTimeout() {
+        return false;
+    }
+
+};
+
+
+}
+}
@@ -12,7 +12,7 @@
  */
 
 /*
- *  TODO  add fast rotate detection?
+ *  For full resolution and speed/acceleration, see QuadratureEncoder.hpp
  */
 
 /*
@@ -30,14 +30,21 @@ template<uint8_t clkPin,
          uint32_t debounceWaitTime,
          bool passiveState,
          bool usePullupP,
-         bool reverseP=false>
+         bool reverseP=false,
+         uint8_t eventQueueSize=0,
+         typename Stamp=uint32_t>
 class RotaryEncoder {
 
-    HAL::GPIO::GPIO<dtPin> dt;
-    HAL::Utils::IntTransitionDebouncer<clkPin,
-                                       debounceWaitTime,
-                                       passiveState,
-                                       usePullupP> debouncer;
+    using Debouncer = HAL::Utils::IntTransitionDebouncer<clkPin,
+                                                         debounceWaitTime,
+                                                         passiveState,
+                                                         usePullupP,
+                                                         eventQueueSize,
+                                                         Stamp,
+                                                         false>;
+    using DT        = HAL::GPIO::GPIO<dtPin>;
+
+    Debouncer debouncer;
     Callback onCW;
     Callback onCCW;
     
@@ -53,8 +60,7 @@ class RotaryEncoder {
 
   public:
     RotaryEncoder()
-        : dt        { },
-          debouncer { },
+        : debouncer { },
           onCW      { nullptr },
           onCCW     { nullptr } {
     }
@@ -62,9 +68,13 @@ class RotaryEncoder {
     void begin() {
         debouncer.begin();
         if constexpr (usePullupP)
-            dt.setInputPullup();
+            DT::setInputPullup();
         else
-            dt.setInput();
+            DT::setInput();
+    }
+
+    static constexpr uint8_t pcintMask(uint8_t pcicrBit) {
+        return Debouncer::pcintMask(pcicrBit);
     }
 
     void notifyInterruptOccurred(uint32_t now, uint8_t changed) {
@@ -80,7 +90,7 @@ class RotaryEncoder {
         RotaryEncoderAction rea { RotaryEncoderAction::NONE };
 
         if (dbTransition == Transition::FALLING) {
-            bool dtState = dt.read();
+            bool dtState = DT::read();
             if (dtState == passiveState) {
                 rea = (!reverseP) ? RotaryEncoderAction::CCW : RotaryEncoderAction::CW;
             } else {
@@ -103,6 +113,11 @@ class RotaryEncoder {
     }
 
 
+    // edges lost to a full event queue (see IntTransitionDebouncer)
+    uint8_t droppedEvents() {
+        return debouncer.droppedEvents();
+    }
+
     bool pendingDebounceTimeout() {
         return debouncer.pendingDebounceTimeout();
     }
@@ -33,23 +33,31 @@ template<uint8_t btnPin,
          bool     reUsePullup,
          bool     btnSuppressReleaseAfterLongPress=true,
          bool     btnAllowConsecutiveLongPresses=false,
-         bool     reReverseP=false>
+         bool     reReverseP=false,
+         typename Stamp=uint32_t>
 class RotaryEncoderWithButton {
 
-    HAL::Devices::Button<btnPin,
-                         btnDebounceWaitTime,
-                         btnLongPressWaitTime,
-                         btnPassiveState,
-                         btnUsePullup,
-                         btnSuppressReleaseAfterLongPress,
-                         btnAllowConsecutiveLongPresses> btn;
-
-    HAL::Devices::RotaryEncoder<reClkPin,
-                                reDtPin,
-                                reDebounceWaitTime,
-                                rePassiveState,
-                                reUsePullup,
-                                reReverseP> re;
+    using Btn = HAL::Devices::Button<btnPin,
+                                     btnDebounceWaitTime,
+                                     btnLongPressWaitTime,
+                                     btnPassiveState,
+                                     btnUsePullup,
+                                     btnSuppressReleaseAfterLongPress,
+                                     btnAllowConsecutiveLongPresses,
+                                     0,
+                                     Stamp>;
+
+    using RE = HAL::Devices::RotaryEncoder<reClkPin,
+                                           reDtPin,
+                                           reDebounceWaitTime,
+                                           rePassiveState,
+                                           reUsePullup,
+                                           reReverseP,
+                                           0,
+                                           Stamp>;
+
+    Btn btn;
+    RE  re;
 
     bool     suppressNextRelease;
     Callback onRelease;
@@ -79,6 +87,10 @@ class RotaryEncoderWithButton {
     re.begin();
     }
 
+    static constexpr uint8_t pcintMask(uint8_t pcicrBit) {
+        return Btn::pcintMask(pcicrBit) | RE::pcintMask(pcicrBit);
+    }
+
     void notifyInterruptOccurred(uint32_t now, uint8_t changed) {
         btn.notifyInterruptOccurred(now, changed);
         re.notifyInterruptOccurred(now, changed);
@@ -2,6 +2,7 @@
 
 #include "common.hpp"
 #include <stdint.h>
+#include <util/atomic.h>
 
 #include <avr/interrupt.h>
 #include <avr/io.h>
@@ -64,61 +65,327 @@ constexpr PinInfo pinTable[28] = {
 };
 #endif
 
-struct PinRegisters {
-    volatile uint8_t* ddr;
-    volatile uint8_t* port;
-    volatile uint8_t* pin;
-    volatile uint8_t* pcmsk;
+/**
+ * Compile-time mapping from a Port to its registers
+ *
+ * Every accessor returns the SFR itself (not a pointer to it), so with
+ * a constexpr mask the compiler can emit a single sbi/cbi/sbic/sbis
+ * instead of a pointer load and a read-modify-write
+ */
+template<Port port>
+struct PortRegisters;
+
+#if defined(__AVR_ATtiny85__)
+template<>
+struct PortRegisters<Port::B> {
+    static inline volatile uint8_t& ddr()   { return DDRB;  }
+    static inline volatile uint8_t& port()  { return PORTB; }
+    static inline volatile uint8_t& pin()   { return PINB;  }
+    static inline volatile uint8_t& pcmsk() { return PCMSK; }
+};
+#elif defined(__AVR_ATmega328P__)
+template<>
+struct PortRegisters<Port::B> {
+    static inline volatile uint8_t& ddr()   { return DDRB;   }
+    static inline volatile uint8_t& port()  { return PORTB;  }
+    static inline volatile uint8_t& pin()   { return PINB;   }
+    static inline volatile uint8_t& pcmsk() { return PCMSK0; }
 };
 
-#if defined(__AVR_ATmega328P__)
-inline PinRegisters resolveRegisters(Port port) {
-    switch (port) {
-        case Port::B: return { &DDRB, &PORTB, &PINB, &PCMSK0 };
-        case Port::C: return { &DDRC, &PORTC, &PINC, &PCMSK1 };
-        case Port::D: return { &DDRD, &PORTD, &PIND, &PCMSK2 };
-        default:      return { nullptr, nullptr, nullptr, nullptr };
-    }
-}
+template<>
+struct PortRegisters<Port::C> {
+    static inline volatile uint8_t& ddr()   { return DDRC;   }
+    static inline volatile uint8_t& port()  { return PORTC;  }
+    static inline volatile uint8_t& pin()   { return PINC;   }
+    static inline volatile uint8_t& pcmsk() { return PCMSK1; }
+};
+
+template<>
+struct PortRegisters<Port::D> {
+    static inline volatile uint8_t& ddr()   { return DDRD;   }
+    static inline volatile uint8_t& port()  { return PORTD;  }
+    static inline volatile uint8_t& pin()   { return PIND;   }
+    static inline volatile uint8_t& pcmsk() { return PCMSK2; }
+};
 #endif
 
+inline void enablePCIE(uint8_t pcicrBit) {
+#if defined(__AVR_ATtiny85__)
+    GIMSK |= (1 << pcicrBit);
+#elif defined(__AVR_ATmega328P__)
+    PCICR |= (1 << pcicrBit);
+#endif
+}
+
 template<uint8_t physicalPin>
 struct GPIO {
 
 #if defined(__AVR_ATtiny85__)
-    static_assert(physicalPin < 8 || physicalPin > 1,
+    static_assert(physicalPin >= 1 && physicalPin <= 8,
             "Invalid pin number for ATTiny85");
 #elif defined(__AVR_ATmega328P__)
-    static_assert(physicalPin < 29 || physicalPin > 0,
+    static_assert(physicalPin >= 1 && physicalPin <= 28,
             "Invalid pin number for ATMega328P");
 #endif
 
     static constexpr PinInfo info = pinTable[physicalPin-1];
 
-#if defined(__AVR_ATtiny85__)
-    static inline PinRegisters regs = { &DDRB, &PORTB, &PINB, &PCMSK };
-#elif defined(__AVR_ATmega328P__)
-    // resolved at runtime :(
-    static inline PinRegisters regs = resolveRegisters(info.port);
-#endif
-    static inline uint8_t mask = (1 << info.bit);
+    static_assert(info.port != Port::Invalid,
+            "Physical pin is not a GPIO (power, ground, reset, or crystal)");
+
+    using regs = PortRegisters<info.port>;
+
+    static constexpr uint8_t mask = (1 << info.bit);
 
-    static inline void setOutput() { *(regs.ddr)  |=  mask; }
-    static inline void setInput()  { *(regs.ddr)  &= ~mask; }
-    static inline void setHigh()   { *(regs.port) |=  mask; }
-    static inline void setLow()    { *(regs.port) &= ~mask; }
-    static inline void toggle()    { *(regs.port) ^=  mask; }
-    static inline bool read()      { return *(regs.pin) & mask; }
+    static inline void setOutput() { regs::ddr()  |=  mask; }
+    static inline void setInput()  { regs::ddr()  &= ~mask; }
+    static inline void setHigh()   { regs::port() |=  mask; }
+    static inline void setLow()    { regs::port() &= ~mask; }
+    // writing a one to PINx toggles PORTx; an `ldi` and an `out`, a
+    // plain write with no read-modify-write, so safe against ISRs
+    static inline void toggle()    { regs::pin()   =  mask; }
+    static inline bool read()      { return regs::pin() & mask; }
 
     static inline void setInputPullup() { setInput(); setHigh(); }
 
     static inline void enablePCINT() {
-#if defined(__AVR_ATtiny85__)
-        GIMSK |= (1 << info.pcicrBit);
-#elif defined(__AVR_ATmega328P__)
-        PCICR |= (1 << info.pcicrBit);
+        enablePCIE(info.pcicrBit);
+        regs::pcmsk() |= mask;
+    }
+};
+
+
+/**
+ * A group of pins that is read and written as a single value
+ *
+ *      HAL::GPIO::PinGroup<14, 15, 16, 17> nibble;
+ *      nibble.setOutput();
+ *      nibble.write(0b1010);   // bit 0 -> pin 14, bit 1 -> pin 15, ...
+ *
+ * At compile time, the pins are sorted into their ports and a mask is
+ * built for each port. Every operation then touches each port exactly
+ * once (one read for `read()`, one guarded read-modify-write for
+ * `write()`), so a parallel bus can't tear between pins on the same port
+ * and a port with no pins in the group costs nothing.
+ *
+ * The scatter/gather of value bits to port bits is generated per-pin at
+ * compile time. When the pins on a port are consecutive (in both value
+ * bits and port bits) it collapses to a single shift and mask.
+ */
+template<uint8_t... physicalPins>
+class PinGroup {
+
+    static constexpr uint8_t count  { sizeof...(physicalPins) };
+    static constexpr uint8_t pins[] { physicalPins... };
+    static constexpr uint8_t numPhysicalPins {
+        sizeof(pinTable) / sizeof(pinTable[0])
+    };
+
+    static constexpr bool allValid() {
+        for (uint8_t i = 0; i < count; ++i) {
+            if (pins[i] < 1 || pins[i] > numPhysicalPins) return false;
+            if (pinTable[pins[i]-1].port == Port::Invalid) return false;
+        }
+        return true;
+    }
+
+    static constexpr bool noDuplicates() {
+        for (uint8_t i = 0; i < count; ++i)
+            for (uint8_t j = i + 1; j < count; ++j)
+                if (pins[i] == pins[j]) return false;
+        return true;
+    }
+
+    static_assert(count > 0 && count <= 32, "PinGroup needs 1 to 32 pins");
+    static_assert(allValid(),
+            "PinGroup contains a pin that is not a GPIO on this MCU");
+    static_assert(noDuplicates(), "PinGroup contains a duplicate pin");
+
+    static constexpr PinInfo infoAt(uint8_t i) { return pinTable[pins[i]-1]; }
+
+  public:
+
+    using value_type = typename Conditional<(count <= 8), uint8_t,
+                       typename Conditional<(count <= 16), uint16_t,
+                                            uint32_t>::type>::type;
+
+    template<Port port>
+    static constexpr uint8_t portMask() {
+        uint8_t m { 0 };
+        for (uint8_t i = 0; i < count; ++i)
+            if (infoAt(i).port == port) m |= (1 << infoAt(i).bit);
+        return m;
+    }
+
+  private:
+
+    // if every pin on `port` sits at (value bit + offset), the whole
+    // scatter/gather is one shift
+    template<Port port>
+    static constexpr bool isContiguous() {
+        bool    first  { true };
+        int16_t offset { 0 };
+        for (uint8_t i = 0; i < count; ++i) {
+            if (infoAt(i).port != port) continue;
+            int16_t thisOffset = static_cast<int16_t>(infoAt(i).bit) - i;
+            if (first) { offset = thisOffset; first = false; }
+            else if (thisOffset != offset) return false;
+        }
+        return true;
+    }
+
+    template<Port port>
+    static constexpr int16_t portOffset() {
+        for (uint8_t i = 0; i < count; ++i)
+            if (infoAt(i).port == port)
+                return static_cast<int16_t>(infoAt(i).bit) - i;
+        return 0;
+    }
+
+    template<Port port, uint8_t i = 0>
+    static inline uint8_t scatter(value_type value) {
+        if constexpr (i >= count) {
+            return 0;
+        } else if constexpr (i == 0 && isContiguous<port>()) {
+            constexpr int16_t offset = portOffset<port>();
+            if constexpr (offset >= 0)
+                return static_cast<uint8_t>(value << offset) & portMask<port>();
+            else
+                return static_cast<uint8_t>(value >> -offset) & portMask<port>();
+        } else {
+            uint8_t bits { scatter<port, i + 1>(value) };
+            if constexpr (infoAt(i).port == port) {
+                if (value & (static_cast<value_type>(1) << i))
+                    bits |= (1 << infoAt(i).bit);
+            }
+            return bits;
+        }
+    }
+
+    template<Port port, uint8_t i = 0>
+    static inline value_type gather(uint8_t bits) {
+        if constexpr (i >= count) {
+            return 0;
+        } else if constexpr (i == 0 && isContiguous<port>()) {
+            constexpr int16_t offset = portOffset<port>();
+            value_type masked = bits & portMask<port>();
+            if constexpr (offset >= 0)
+                return masked >> offset;
+            else
+                return masked << -offset;
+        } else {
+            value_type value { gather<port, i + 1>(bits) };
+            if constexpr (infoAt(i).port == port) {
+                if (bits & (1 << infoAt(i).bit))
+                    value |= (static_cast<value_type>(1) << i);
+            }
+            return value;
+        }
+    }
+
+    template<Port port>
+    static inline void writePort(value_type value) {
+        constexpr uint8_t m = portMask<port>();
+        if constexpr (m != 0) {
+            uint8_t bits = scatter<port>(value);
+            if constexpr (m == 0xFF) {
+                PortRegisters<port>::port() = bits;
+            } else {
+                ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+                    PortRegisters<port>::port() =
+                        (PortRegisters<port>::port() & ~m) | bits;
+                }
+            }
+        }
+    }
+
+    template<Port port>
+    static inline value_type readPort() {
+        if constexpr (portMask<port>() != 0)
+            return gather<port>(PortRegisters<port>::pin());
+        else
+            return 0;
+    }
+
+    template<Port port>
+    static inline void setDDR(bool output) {
+        constexpr uint8_t m = portMask<port>();
+        if constexpr (m != 0) {
+            if (output) PortRegisters<port>::ddr() |=  m;
+            else        PortRegisters<port>::ddr() &= ~m;
+        }
+    }
+
+    template<Port port>
+    static inline void setPullups() {
+        constexpr uint8_t m = portMask<port>();
+        if constexpr (m != 0) PortRegisters<port>::port() |= m;
+    }
+
+    template<Port port>
+    static inline void enablePortPCINT() {
+        constexpr uint8_t m = portMask<port>();
+        if constexpr (m != 0) {
+            for (uint8_t i = 0; i < count; ++i) {
+                if (infoAt(i).port == port) {
+                    enablePCIE(infoAt(i).pcicrBit);
+                    break;
+                }
+            }
+            PortRegisters<port>::pcmsk() |= m;
+        }
+    }
+
+  public:
+
+    static inline void write(value_type value) {
+        writePort<Port::B>(value);
+#if defined(__AVR_ATmega328P__)
+        writePort<Port::C>(value);
+        writePort<Port::D>(value);
+#endif
+    }
+
+    static inline value_type read() {
+        value_type value { readPort<Port::B>() };
+#if defined(__AVR_ATmega328P__)
+        value |= readPort<Port::C>();
+        value |= readPort<Port::D>();
+#endif
+        return value;
+    }
+
+    static inline void setOutput() {
+        setDDR<Port::B>(true);
+#if defined(__AVR_ATmega328P__)
+        setDDR<Port::C>(true);
+        setDDR<Port::D>(true);
+#endif
+    }
+
+    static inline void setInput() {
+        setDDR<Port::B>(false);
+#if defined(__AVR_ATmega328P__)
+        setDDR<Port::C>(false);
+        setDDR<Port::D>(false);
+#endif
+    }
+
+    static inline void setInputPullup() {
+        setInput();
+        setPullups<Port::B>();
+#if defined(__AVR_ATmega328P__)
+        setPullups<Port::C>();
+        setPullups<Port::D>();
+#endif
+    }
+
+    static inline void enablePCINT() {
+        enablePortPCINT<Port::B>();
+#if defined(__AVR_ATmega328P__)
+        enablePortPCINT<Port::C>();
+        enablePortPCINT<Port::D>();
 #endif
-        *(regs.pcmsk) |= mask;
     }
 };
 
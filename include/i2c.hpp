@@ -0,0 +1,440 @@
+#pragma once
+
+#include "common.hpp"
+#include "gpio.hpp"
+#include "utils/RingBuffer.hpp"
+
+#include <stdint.h>
+#include <util/atomic.h>
+#include <util/delay.h>
+#include <avr/io.h>
+#include <avr/interrupt.h>
+
+/**
+ * I2C
+ *
+ * I2C master with a queue of transactions, on the TWI of the ATmega328P
+ * or the USI of the ATtiny85 (two-wire mode)
+ *
+        using I2c = HAL::I2C::Master<400000>;
+        HAL_I2C_ISR(I2c)
+
+        static const uint8_t reg[] { 0x3B };
+        static uint8_t sample[6];
+
+        void onSample(HAL::I2C::Status status) {
+            if (status == HAL::I2C::Status::OK) ...
+        }
+
+        I2c::begin();
+        sei();
+        I2c::writeRead(0x68, reg, sizeof(reg), sample, sizeof(sample), onSample);
+ *
+ * A transaction writes `txLength` bytes, then (after a repeated start)
+ * reads `rxLength`, skipping either half that's empty: write(),
+ * read() and writeRead() just fill one in. With both empty it only
+ * sends the address, which probes for a device. The buffers are the
+ * caller's and have to stay put until `done` is called, from the ISR,
+ * with how it went; it may queue another transaction. `queue` returns
+ * false when all `queueSize` slots are taken.
+ *
+ *   OK                 every byte went through
+ *   NACK_ADDRESS       nobody answered to the address
+ *   NACK_DATA          the device didn't acknowledge a byte written to it
+ *   ARBITRATION_LOST   another master took the bus
+ *   BUS_ERROR          a START or STOP in the wrong place (or, on the
+ *                      ATtiny85, one that didn't come out right)
+ *
+ * A failed transaction ends with a STOP, and the queue carries on with
+ * the next one.
+ *
+ * On the ATmega328P, TWBR and the prescaler are worked out at compile
+ * time for the fastest SCL at or under `clockHz` (400 kHz needs F_CPU of
+ * at least 6.4 MHz); `actualHz` is what it comes out as, without the
+ * slowdown of the rise times. Every bus event is one TWI_vect
+ * interrupt, so a 6-byte read at 400 kHz costs the main loop a few
+ * dozen short interrupts rather than 150 us of spinning.
+ * SDA is pin 27 and SCL pin 28.
+ *
+ * On the ATtiny85, SDA is pin 5 (PB0) and SCL pin 7 (PB2). As with
+ * HAL::SPI, the USI can only be clocked by Timer0 (HAL::Ticker's) or by
+ * the CPU, so the CPU drives SCL with the standard (100 kHz) or fast
+ * mode (above that) bus timings, spread out to a period of `clockHz`
+ * where that's slower, and honours clock stretching: `queue`
+ * runs the transaction and calls `done` before it returns.
+ *
+ * The internal pull-ups are switched on with `usePullupP`, but they're
+ * ~40 kOhm: fine for a short bus at 100 kHz, not for 400 kHz (use
+ * 4.7 kOhm or less).
+ *
+ * `busy()` is true while there's a transaction in progress or queued;
+ * check it before powering down (HAL::Sleep::Governor, with PRTWI kept
+ * on) or the transaction dies half way.
+ */
+
+namespace HAL {
+namespace I2C {
+
+enum class Status : uint8_t { OK, NACK_ADDRESS, NACK_DATA, ARBITRATION_LOST, BUS_ERROR };
+
+using Done = void (*)(Status status);
+
+struct Transaction {
+    uint8_t        address;     // 7 bits
+    const uint8_t* tx;
+    uint8_t        txLength;
+    uint8_t*       rx;
+    uint8_t        rxLength;
+    Done           done;
+};
+
+#if defined(__AVR_ATmega328P__)
+
+struct BitRate {
+    uint8_t  twbr;
+    uint8_t  twpsBits;
+    uint32_t actualHz;  // 0 if nothing fits
+};
+
+// SCL = F_CPU / (16 + 2 * TWBR * 4^TWPS), as fast as clockHz allows
+constexpr BitRate chooseBitRate(uint32_t clockHz) {
+    if (F_CPU < 16UL * clockHz) return { 0, 0, 0 };
+    uint32_t cycles = (F_CPU + clockHz - 1) / clockHz;      // at least
+    for (uint8_t twps = 0; twps < 4; ++twps) {
+        uint32_t prescaler = 1UL << (2 * twps);
+        uint32_t twbr      = (cycles - 16 + 2 * prescaler - 1) / (2 * prescaler);
+        if (twbr <= 255)
+            return { static_cast<uint8_t>(twbr), twps,
+                     static_cast<uint32_t>(F_CPU / (16 + 2 * twbr * prescaler)) };
+    }
+    return { 0, 0, 0 };
+}
+
+#endif
+
+template<uint32_t clockHz=100000,
+         uint8_t  queueSize=4,
+         bool     usePullupP=true>
+struct Master {
+
+    static_assert(clockHz > 0 && clockHz <= 400000, "I2C runs at up to 400 kHz");
+
+#if defined(__AVR_ATmega328P__)
+    static constexpr BitRate bitRate { chooseBitRate(clockHz) };
+    static_assert(bitRate.actualHz != 0, "F_CPU is too slow (or too fast) for that clockHz");
+    static constexpr uint32_t actualHz { bitRate.actualHz };
+
+    using SDA = HAL::GPIO::GPIO<27>;
+    using SCL = HAL::GPIO::GPIO<28>;
+#elif defined(__AVR_ATtiny85__)
+    using SDA = HAL::GPIO::GPIO<5>;
+    using SCL = HAL::GPIO::GPIO<7>;
+#endif
+
+    static inline HAL::Utils::RingBuffer<Transaction, queueSize> pending;
+    static inline Transaction       current { };
+    static inline uint8_t           index   { 0 };
+    static inline bool              reading { false };
+    static inline volatile bool     active  { false };
+    static inline volatile Status   last    { Status::OK };
+
+    static inline bool busy() { return active; }
+
+    static inline void flush() {
+        while (active) { }
+    }
+
+    // how the most recently finished transaction went
+    static inline Status lastStatus() { return last; }
+
+    static void begin() {
+        if constexpr (usePullupP) {
+            SDA::setHigh();
+            SCL::setHigh();
+        }
+#if defined(__AVR_ATmega328P__)
+        PRR  &= ~(1 << PRTWI);
+        TWBR  = bitRate.twbr;
+        TWSR  = bitRate.twpsBits;
+        TWCR  = (1 << TWEN);
+#elif defined(__AVR_ATtiny85__)
+        PRR  &= ~(1 << PRUSI);
+        // both released (high) and open drain: the USI only ever pulls
+        // them low
+        SDA::setHigh();
+        SCL::setHigh();
+        SDA::setOutput();
+        SCL::setOutput();
+        USIDR = 0xFF;
+        USICR = (1 << USIWM1) | (1 << USICS1) | (1 << USICLK);
+        USISR = (1 << USISIF) | (1 << USIOIF) | (1 << USIPF) | (1 << USIDC);
+#endif
+        ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+            active = false;
+            pending.discard(pending.count());
+        }
+    }
+
+    static void end() {
+        flush();
+#if defined(__AVR_ATmega328P__)
+        TWCR = 0;
+#elif defined(__AVR_ATtiny85__)
+        USICR = 0;
+        SDA::setInput();
+        SCL::setInput();
+#endif
+    }
+
+#if defined(__AVR_ATmega328P__)
+
+    static constexpr uint8_t next  { (1 << TWINT) | (1 << TWEN) | (1 << TWIE) };
+    static constexpr uint8_t start { next | (1 << TWSTA) };
+    static constexpr uint8_t stop  { (1 << TWINT) | (1 << TWEN) | (1 << TWSTO) };
+
+    // the (repeated) START is out: which way does this half go?
+    static inline uint8_t addressByte() {
+        reading = (current.txLength == 0 || index == current.txLength) && current.rxLength;
+        if (reading) index = 0;
+        return static_cast<uint8_t>(current.address << 1) | (reading ? 1 : 0);
+    }
+
+    static inline uint8_t ackUnlessLast() {
+        return (index + 1 < current.rxLength) ? (next | (1 << TWEA)) : next;
+    }
+
+    // STOP, then straight on with the next transaction if there is one
+    static void finish(Status status) {
+        Done done = current.done;
+        last = status;
+        if (pending.pop(current)) {
+            index = 0;
+            // STOP and START together: the TWI sends one, then the other
+            TWCR = stop | start;
+        } else {
+            TWCR   = stop;
+            active = false;
+        }
+        if (done) done(status);
+    }
+
+    // call this (and only this) from ISR(TWI_vect)
+    static inline void onInterrupt() {
+        switch (TWSR & 0xF8) {
+            case 0x08:      // START
+            case 0x10:      // repeated START
+                TWDR = addressByte();
+                TWCR = next;
+                break;
+
+            case 0x18:      // SLA+W, ACK
+            case 0x28:      // data written, ACK
+                if (index < current.txLength) {
+                    TWDR = current.tx[index++];
+                    TWCR = next;
+                } else if (current.rxLength) {
+                    TWCR = start;
+                } else {
+                    finish(Status::OK);
+                }
+                break;
+
+            case 0x40:      // SLA+R, ACK
+                TWCR = ackUnlessLast();
+                break;
+
+            case 0x50:      // data read, ACK
+                current.rx[index++] = TWDR;
+                TWCR = ackUnlessLast();
+                break;
+
+            case 0x58:      // data read, NACK (we sent it: that was the last)
+                current.rx[index++] = TWDR;
+                finish(Status::OK);
+                break;
+
+            case 0x20:      // SLA+W, NACK
+            case 0x48:      // SLA+R, NACK
+                finish(Status::NACK_ADDRESS);
+                break;
+
+            case 0x30:      // data written, NACK
+                finish(Status::NACK_DATA);
+                break;
+
+            case 0x38: {    // arbitration lost: let go of the bus, no STOP
+                Done done = current.done;
+                last = Status::ARBITRATION_LOST;
+                if (pending.pop(current)) {
+                    index = 0;
+                    TWCR  = start;      // sent once the bus is free
+                } else {
+                    TWCR   = (1 << TWINT) | (1 << TWEN);
+                    active = false;
+                }
+                if (done) done(Status::ARBITRATION_LOST);
+                break;
+            }
+
+            default:        // 0x00, bus error
+                finish(Status::BUS_ERROR);
+                break;
+        }
+    }
+
+    // false if the queue's full
+    static bool queue(const Transaction& transaction) {
+        // callbacks queue from the ISR too, so both sides push with
+        // interrupts off
+        bool queued;
+        ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+            queued = pending.push(transaction);
+            if (queued && !active) {
+                active = true;
+                pending.pop(current);
+                index = 0;
+                // the last STOP may still be going out
+                while (TWCR & (1 << TWSTO)) { }
+                TWCR = start;
+            }
+        }
+        return queued;
+    }
+
+#elif defined(__AVR_ATtiny85__)
+
+    // standard mode up to 100 kHz, fast mode above, with low and high
+    // stretched in proportion when clockHz is slower than the mode's
+    // minimums allow; the loop adds to both, so SCL comes out a bit slower
+    static constexpr double minLowUs  { (clockHz > 100000) ? 1.3 : 4.7 };
+    static constexpr double minHighUs { (clockHz > 100000) ? 0.6 : 4.0 };
+    static constexpr double stretch {
+        (1e6 / clockHz > minLowUs + minHighUs)
+            ? 1e6 / clockHz / (minLowUs + minHighUs) : 1.0
+    };
+    static constexpr double lowUs  { minLowUs * stretch };
+    static constexpr double highUs { minHighUs * stretch };
+
+    static constexpr uint8_t strobe {
+        (1 << USIWM1) | (1 << USICS1) | (1 << USICLK) | (1 << USITC)
+    };
+    static constexpr uint8_t clearFlags {
+        (1 << USISIF) | (1 << USIOIF) | (1 << USIPF) | (1 << USIDC)
+    };
+
+    // clocks out (and in) 8 bits, or 1 with the counter at 14
+    static uint8_t shift(uint8_t counter) {
+        USISR = clearFlags | counter;
+        do {
+            _delay_us(lowUs);
+            USICR = strobe;                 // SCL up
+            while (!SCL::read()) { }        // held low: stretching
+            _delay_us(highUs);
+            USICR = strobe;                 // SCL down
+        } while (!(USISR & (1 << USIOIF)));
+        _delay_us(lowUs);
+        uint8_t data = USIDR;
+        USIDR = 0xFF;
+        SDA::setOutput();
+        return data;
+    }
+
+    static bool startCondition() {
+        SCL::setHigh();
+        while (!SCL::read()) { }
+        _delay_us(lowUs);
+        SDA::setLow();
+        _delay_us(highUs);
+        SCL::setLow();
+        SDA::setHigh();
+        return USISR & (1 << USISIF);
+    }
+
+    static bool stopCondition() {
+        SDA::setLow();
+        SCL::setHigh();
+        while (!SCL::read()) { }
+        _delay_us(highUs);
+        SDA::setHigh();
+        _delay_us(lowUs);
+        return USISR & (1 << USIPF);
+    }
+
+    // true if acknowledged
+    static bool writeByte(uint8_t data) {
+        SCL::setLow();
+        USIDR = data;
+        shift(0);
+        SDA::setInput();
+        return !(shift(0x0E) & 0x01);
+    }
+
+    static uint8_t readByte(bool ack) {
+        SDA::setInput();
+        uint8_t data = shift(0);
+        USIDR = ack ? 0x00 : 0xFF;
+        shift(0x0E);
+        return data;
+    }
+
+    static Status run(const Transaction& t) {
+        if (t.txLength || !t.rxLength) {
+            if (!startCondition()) return Status::BUS_ERROR;
+            if (!writeByte(static_cast<uint8_t>(t.address << 1)))
+                return Status::NACK_ADDRESS;
+            for (uint8_t i = 0; i < t.txLength; ++i)
+                if (!writeByte(t.tx[i])) return Status::NACK_DATA;
+        }
+        if (t.rxLength) {
+            if (!startCondition()) return Status::BUS_ERROR;
+            if (!writeByte(static_cast<uint8_t>(t.address << 1) | 1))
+                return Status::NACK_ADDRESS;
+            for (uint8_t i = 0; i < t.rxLength; ++i)
+                t.rx[i] = readByte(i + 1 < t.rxLength);
+        }
+        return Status::OK;
+    }
+
+    static bool queue(const Transaction& transaction) {
+        active = true;
+        Status status = run(transaction);
+        if (!stopCondition() && status == Status::OK) status = Status::BUS_ERROR;
+        last   = status;
+        active = false;
+        if (transaction.done) transaction.done(status);
+        return true;
+    }
+
+#endif
+
+    static inline bool write(uint8_t address, const uint8_t* data, uint8_t length,
+                             Done done=nullptr) {
+        return queue({ address, data, length, nullptr, 0, done });
+    }
+
+    static inline bool read(uint8_t address, uint8_t* data, uint8_t length,
+                            Done done=nullptr) {
+        return queue({ address, nullptr, 0, data, length, done });
+    }
+
+    static inline bool writeRead(uint8_t address,
+                                 const uint8_t* tx, uint8_t txLength,
+                                 uint8_t* rx, uint8_t rxLength,
+                                 Done done=nullptr) {
+        return queue({ address, tx, txLength, rx, rxLength, done });
+    }
+};
+
+#if defined(__AVR_ATmega328P__)
+#define HAL_I2C_ISR(I2c)                      \
+    ISR(TWI_vect) {                           \
+        I2c::onInterrupt();                   \
+    }
+#elif defined(__AVR_ATtiny85__)
+// nothing to do: the USI transactions are all blocking
+#define HAL_I2C_ISR(I2c)
+#endif
+
+
+}
+}
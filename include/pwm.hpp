@@ -0,0 +1,393 @@
+#pragma once
+
+#include "common.hpp"
+#include "gpio.hpp"
+
+#include <stdint.h>
+#include <util/atomic.h>
+#include <avr/io.h>
+
+/**
+ * PWM
+ *
+ * Hardware PWM on the timer output compare pins
+ *
+        HAL::PWM<15, 20000> motor;      // OC1A, 20 kHz
+        motor.begin();
+        motor.write(128);               // 0 (off) to 255 (on)
+        motor.writeRaw(motor.period / 3);
+ *
+ * The pin picks the timer and channel (from `pinTable`); the mode,
+ * prescaler and TOP are worked out at compile time, the same way
+ * src/ticker.cpp picks Timer0's prescaler, taking the smallest prescaler
+ * that fits (so the largest TOP, the finest duty steps). If the nearest
+ * frequency the timer can do is more than `maxErrorPercent` off, it
+ * doesn't compile. `period` is how many duty steps there are and
+ * `actualHz` what the frequency came out as.
+ *
+ *   ATmega328P
+ *     OC1A (15), OC1B (16)  Timer1, fast PWM with TOP in ICR1: any
+ *                           frequency, up to 16 bits of resolution
+ *     OC2A (17)             Timer2, fast or phase correct PWM at TOP 0xFF:
+ *                           F_CPU / prescaler / 256 or 510 only
+ *     OC2B (5)              Timer2, fast PWM with TOP in OCR2A if that
+ *                           gets closer (which takes OC2A away), else as
+ *                           OC2A
+ *     OC0B (11)             rides along on HAL::Ticker's Timer0 at 1 kHz;
+ *                           `frequencyHz` must be 1000, and not tickless
+ *
+ *   ATtiny85
+ *     OC1A (6), OC1B (3)    Timer1, TOP in OCR1C, clocked from the CPU
+ *                           clock or (if that gives more resolution) the
+ *                           64 MHz PLL, prescaler 1 to 16384
+ *
+ * OC0A is Timer0's TOP, which HAL::Ticker depends on, so it's refused
+ * (on the tiny85 that's pin 5; pin 6 is OC1A rather than OC0B).
+ *
+ * Both channels of a timer share its frequency: give them the same
+ * `frequencyHz` (each `begin()` sets the timer up).
+ *
+ * The compare registers are double-buffered in PWM mode, so a new duty
+ * cycle takes effect at the end of the current period: no glitches or
+ * short pulses. 0 and full scale disconnect the output and drive the pin
+ * low or high instead, since fast PWM can't do a clean 0% (it leaves a
+ * one-count spike).
+ *
+ * For OC0B, call `begin()` after `HAL::Ticker::setupMSTimer()` (which
+ * rewrites Timer0's mode); the period then comes from OCR0A.
+ */
+
+namespace HAL {
+namespace PWMTimers {
+
+enum class Timer : uint8_t { NONE, TIMER0, TIMER1, TIMER2 };
+
+enum class Mode : uint8_t { FAST_TOP, FAST_FIXED, PHASE_FIXED, TICKER };
+
+struct Output {
+    Timer   timer;
+    uint8_t channel;    // 0 is A, 1 is B
+};
+
+struct Setup {
+    Mode     mode;
+    uint8_t  csBits;
+    uint16_t top;
+    bool     pll;
+    uint32_t actualHz;  // 0 if nothing fits
+};
+
+constexpr Output getOutput(uint8_t physicalPin) {
+    if (physicalPin < 1 || physicalPin > sizeof(HAL::GPIO::pinTable) / sizeof(HAL::GPIO::pinTable[0]))
+        return { Timer::NONE, 0 };
+    HAL::GPIO::PinInfo pin = HAL::GPIO::pinTable[physicalPin - 1];
+#if defined(__AVR_ATtiny85__)
+    if (pin.port == HAL::GPIO::Port::B) {
+        if (pin.bit == 0) return { Timer::TIMER0, 0 };
+        if (pin.bit == 1) return { Timer::TIMER1, 0 };
+        if (pin.bit == 4) return { Timer::TIMER1, 1 };
+    }
+#elif defined(__AVR_ATmega328P__)
+    if (pin.port == HAL::GPIO::Port::D) {
+        if (pin.bit == 6) return { Timer::TIMER0, 0 };
+        if (pin.bit == 5) return { Timer::TIMER0, 1 };
+        if (pin.bit == 3) return { Timer::TIMER2, 1 };
+    }
+    if (pin.port == HAL::GPIO::Port::B) {
+        if (pin.bit == 1) return { Timer::TIMER1, 0 };
+        if (pin.bit == 2) return { Timer::TIMER1, 1 };
+        if (pin.bit == 3) return { Timer::TIMER2, 0 };
+    }
+#endif
+    return { Timer::NONE, 0 };
+}
+
+constexpr uint32_t errorPercentTimes100(uint32_t actual, uint32_t wanted) {
+    uint32_t diff = (actual > wanted) ? actual - wanted : wanted - actual;
+    return static_cast<uint32_t>(static_cast<uint64_t>(diff) * 10000 / wanted);
+}
+
+// ticks of clock / prescaler in one period of frequency, rounded
+constexpr uint64_t countsPerPeriod(uint32_t clock, uint32_t prescaler, uint32_t frequency) {
+    uint64_t divisor = static_cast<uint64_t>(prescaler) * frequency;
+    return (clock + divisor / 2) / divisor;
+}
+
+#if defined(__AVR_ATmega328P__)
+
+constexpr struct PrescalerOption {
+    uint16_t prescaler;
+    uint8_t  cs_bits;
+} timer1_prescaler_options[] = {
+    {1,    (1 << CS10)},
+    {8,    (1 << CS11)},
+    {64,   (1 << CS11) | (1 << CS10)},
+    {256,  (1 << CS12)},
+    {1024, (1 << CS12) | (1 << CS10)}
+}, timer2_prescaler_options[] = {
+    {1,    (1 << CS20)},
+    {8,    (1 << CS21)},
+    {32,   (1 << CS21) | (1 << CS20)},
+    {64,   (1 << CS22)},
+    {128,  (1 << CS22) | (1 << CS20)},
+    {256,  (1 << CS22) | (1 << CS21)},
+    {1024, (1 << CS22) | (1 << CS21) | (1 << CS20)}
+};
+
+constexpr Setup solveTimer1(uint32_t frequency) {
+    for (auto& opt: timer1_prescaler_options) {
+        uint64_t counts = countsPerPeriod(F_CPU, opt.prescaler, frequency);
+        if (counts >= 2 && counts <= 65536)
+            return { Mode::FAST_TOP, opt.cs_bits, static_cast<uint16_t>(counts - 1), false,
+                     static_cast<uint32_t>(F_CPU / (opt.prescaler * counts)) };
+    }
+    return { Mode::FAST_TOP, 0, 0, false, 0 };
+}
+
+constexpr Setup solveTimer2(uint32_t frequency, bool variableTop) {
+    if (variableTop) {
+        for (auto& opt: timer2_prescaler_options) {
+            uint64_t counts = countsPerPeriod(F_CPU, opt.prescaler, frequency);
+            if (counts >= 2 && counts <= 256)
+                return { Mode::FAST_TOP, opt.cs_bits, static_cast<uint16_t>(counts - 1), false,
+                         static_cast<uint32_t>(F_CPU / (opt.prescaler * counts)) };
+        }
+    }
+    // TOP stuck at 0xFF: the closest of fast (256 counts) and phase
+    // correct (510)
+    Setup best { Mode::FAST_FIXED, 0, 0xFF, false, 0 };
+    for (auto& opt: timer2_prescaler_options) {
+        uint32_t fast  = F_CPU / (opt.prescaler * 256UL);
+        uint32_t phase = F_CPU / (opt.prescaler * 510UL);
+        if (!best.actualHz || errorPercentTimes100(fast, frequency)
+                            < errorPercentTimes100(best.actualHz, frequency))
+            best = { Mode::FAST_FIXED, opt.cs_bits, 0xFF, false, fast };
+        if (errorPercentTimes100(phase, frequency)
+                < errorPercentTimes100(best.actualHz, frequency))
+            best = { Mode::PHASE_FIXED, opt.cs_bits, 0xFF, false, phase };
+    }
+    return best;
+}
+
+#elif defined(__AVR_ATtiny85__)
+
+constexpr uint32_t pllHz { 64000000UL };
+
+// the smallest prescaler (CS1 = 1..15 is 1..16384) that fits from `clock`
+constexpr Setup solveTimer1From(uint32_t clock, bool pll, uint32_t frequency) {
+    for (uint8_t cs = 1; cs <= 15; ++cs) {
+        uint32_t prescaler = 1UL << (cs - 1);
+        uint64_t counts    = countsPerPeriod(clock, prescaler, frequency);
+        if (counts >= 2 && counts <= 256)
+            return { Mode::FAST_TOP, cs, static_cast<uint16_t>(counts - 1), pll,
+                     static_cast<uint32_t>(clock / (prescaler * counts)) };
+    }
+    return { Mode::FAST_TOP, 0, 0, pll, 0 };
+}
+
+constexpr Setup solveTimer1(uint32_t frequency) {
+    Setup cpu = solveTimer1From(F_CPU, false, frequency);
+    Setup pll = solveTimer1From(pllHz, true,  frequency);
+    if (!cpu.actualHz) return pll;
+    if (!pll.actualHz) return cpu;
+    return (pll.top > cpu.top) ? pll : cpu;
+}
+
+#endif
+
+constexpr Setup solve(Output output, uint32_t frequency) {
+    if (frequency == 0) return { Mode::FAST_TOP, 0, 0, false, 0 };
+    switch (output.timer) {
+        case Timer::TIMER0:
+            return { Mode::TICKER, 0, 0, false, 1000 };
+        case Timer::TIMER1:
+            return solveTimer1(frequency);
+#if defined(__AVR_ATmega328P__)
+        case Timer::TIMER2:
+            return solveTimer2(frequency, output.channel == 1);
+#endif
+        default:
+            return { Mode::FAST_TOP, 0, 0, false, 0 };
+    }
+}
+
+}
+
+template<uint8_t  physicalPin,
+         uint32_t frequencyHz,
+         uint8_t  maxErrorPercent=2>
+struct PWM {
+
+    using Pin = HAL::GPIO::GPIO<physicalPin>;
+
+    static constexpr PWMTimers::Output output { PWMTimers::getOutput(physicalPin) };
+    static constexpr PWMTimers::Setup  setup  { PWMTimers::solve(output, frequencyHz) };
+
+    static_assert(output.timer != PWMTimers::Timer::NONE,
+            "PWM needs an output compare pin (OC0B, OC1A/B, OC2A/B; OC1A/B on the tiny85)");
+    static_assert(!(output.timer == PWMTimers::Timer::TIMER0 && output.channel == 0),
+            "OC0A is Timer0's TOP, which HAL::Ticker needs");
+#if defined(HAL_TICKER_TICKLESS)
+    static_assert(output.timer != PWMTimers::Timer::TIMER0,
+            "OC0B can't ride along on a tickless Ticker (OCR0A keeps moving)");
+#endif
+    static_assert(output.timer != PWMTimers::Timer::TIMER0 || frequencyHz == 1000,
+            "OC0B runs at HAL::Ticker's 1 kHz");
+    static_assert(setup.actualHz != 0, "no prescaler can do that frequency");
+    static_assert(PWMTimers::errorPercentTimes100(setup.actualHz, frequencyHz)
+                  <= maxErrorPercent * 100UL,
+            "the nearest frequency the timer can do is off by more than maxErrorPercent");
+
+    static constexpr uint32_t actualHz { setup.actualHz };
+
+    // duty steps per period (for OC0B, see currentPeriod())
+    static constexpr uint16_t period {
+        (setup.mode == PWMTimers::Mode::PHASE_FIXED) ? setup.top
+                                                     : static_cast<uint16_t>(setup.top + 1)
+    };
+
+    static inline uint16_t currentPeriod() {
+        if constexpr (setup.mode == PWMTimers::Mode::TICKER)
+            return static_cast<uint16_t>(OCR0A) + 1;
+        else
+            return period;
+    }
+
+    static void begin() {
+        Pin::setLow();
+        Pin::setOutput();
+
+        ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+#if defined(__AVR_ATmega328P__)
+            if constexpr (output.timer == PWMTimers::Timer::TIMER0) {
+                // mode 7, fast PWM with TOP = OCR0A: the same period and
+                // compare match A as the ticker's CTC mode
+                TCCR0A |= (1 << WGM01) | (1 << WGM00);
+                TCCR0B |= (1 << WGM02);
+            } else if constexpr (output.timer == PWMTimers::Timer::TIMER1) {
+                TCCR1A = (TCCR1A & 0xF0) | (1 << WGM11);
+                TCCR1B = (1 << WGM13) | (1 << WGM12) | setup.csBits;
+                ICR1   = setup.top;
+            } else {
+                uint8_t wgm = 0;
+                if constexpr (setup.mode == PWMTimers::Mode::FAST_TOP) {
+                    wgm    = (1 << WGM21) | (1 << WGM20);
+                    OCR2A  = static_cast<uint8_t>(setup.top);
+                } else if constexpr (setup.mode == PWMTimers::Mode::FAST_FIXED) {
+                    wgm    = (1 << WGM21) | (1 << WGM20);
+                } else {
+                    wgm    = (1 << WGM20);
+                }
+                TCCR2A = (TCCR2A & 0xF0) | wgm;
+                TCCR2B = ((setup.mode == PWMTimers::Mode::FAST_TOP) ? (1 << WGM22) : 0)
+                       | setup.csBits;
+            }
+#elif defined(__AVR_ATtiny85__)
+            if constexpr (setup.pll) {
+                if (!(PLLCSR & (1 << PCKE))) {
+                    PLLCSR = (1 << PLLE);
+                    // give it ~100 us before looking at PLOCK
+                    for (volatile uint8_t i = 0; i < 100; ++i) { }
+                    while (!(PLLCSR & (1 << PLOCK))) { }
+                    PLLCSR |= (1 << PCKE);
+                }
+            }
+            TCCR1 = (TCCR1 & 0xF0) | setup.csBits;
+            OCR1C = static_cast<uint8_t>(setup.top);
+            if constexpr (output.channel == 0)
+                TCCR1 |= (1 << PWM1A);
+            else
+                GTCCR |= (1 << PWM1B);
+#endif
+        }
+    }
+
+    // output disconnected and driven low; the timer keeps running
+    static void end() {
+        Pin::setLow();
+        disconnect();
+    }
+
+    static inline volatile uint8_t& comRegister() {
+#if defined(__AVR_ATmega328P__)
+        if constexpr (output.timer == PWMTimers::Timer::TIMER0) return TCCR0A;
+        else if constexpr (output.timer == PWMTimers::Timer::TIMER1) return TCCR1A;
+        else return TCCR2A;
+#elif defined(__AVR_ATtiny85__)
+        if constexpr (output.channel == 0) return TCCR1;
+        else return GTCCR;
+#endif
+    }
+
+    // COMxx1 alone, non-inverting
+    static constexpr uint8_t comBit {
+#if defined(__AVR_ATmega328P__)
+        static_cast<uint8_t>(1 << ((output.channel == 0) ? 7 : 5))
+#elif defined(__AVR_ATtiny85__)
+        static_cast<uint8_t>(1 << ((output.channel == 0) ? COM1A1 : COM1B1))
+#endif
+    };
+
+    static inline void connect() {
+        if (!(comRegister() & comBit)) {
+            ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+                comRegister() |= comBit;
+            }
+        }
+    }
+
+    static inline void disconnect() {
+        if (comRegister() & comBit) {
+            ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+                comRegister() &= static_cast<uint8_t>(~comBit);
+            }
+        }
+    }
+
+    static inline void setCompare(uint16_t value) {
+#if defined(__AVR_ATmega328P__)
+        if constexpr (output.timer == PWMTimers::Timer::TIMER0) {
+            OCR0B = static_cast<uint8_t>(value);
+        } else if constexpr (output.timer == PWMTimers::Timer::TIMER1) {
+            ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+                if constexpr (output.channel == 0) OCR1A = value;
+                else                               OCR1B = value;
+            }
+        } else {
+            if constexpr (output.channel == 0) OCR2A = static_cast<uint8_t>(value);
+            else                               OCR2B = static_cast<uint8_t>(value);
+        }
+#elif defined(__AVR_ATtiny85__)
+        if constexpr (output.channel == 0) OCR1A = static_cast<uint8_t>(value);
+        else                               OCR1B = static_cast<uint8_t>(value);
+#endif
+    }
+
+    // high for `counts` out of every period (clamped) timer counts
+    static void writeRaw(uint16_t counts) {
+        uint16_t steps = currentPeriod();
+        // PORT first, so the pin doesn't blip when the timer lets go
+        if (counts == 0) {
+            Pin::setLow();
+            disconnect();
+        } else if (counts >= steps) {
+            Pin::setHigh();
+            disconnect();
+        } else {
+            // phase correct: high while TCNT < OCR; fast: up to OCR
+            if constexpr (setup.mode == PWMTimers::Mode::PHASE_FIXED)
+                setCompare(counts);
+            else
+                setCompare(counts - 1);
+            connect();
+        }
+    }
+
+    // 0 is off, 255 fully on
+    static void write(uint8_t level) {
+        writeRaw(static_cast<uint16_t>(
+                static_cast<uint32_t>(level) * currentPeriod() / 255));
+    }
+};
+
+}
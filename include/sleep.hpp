@@ -1,7 +1,11 @@
 #pragma once
 
 #include "common.hpp"
+#include "ticker.hpp"
+#include "watchdog.hpp"
 
+#include <stdint.h>
+#include <util/atomic.h>
 #include <avr/io.h>
 #include <avr/sleep.h>
 #include <avr/interrupt.h>
@@ -20,5 +24,340 @@ inline void goToSleep(uint8_t mode) {
 }
 
 
+/**
+ * Sleeping without losing track of time
+ *
+ * Timer0 (and so HAL::Ticker) stops in SLEEP_MODE_PWR_DOWN. Rather than
+ * `HAL::Ticker::pause()`, sleep, and guessing a `resume(compTicks)`,
+ *
+        HAL_SLEEP_WDT_ISR()
+        ...
+        HAL::Sleep::TimedSleep::calibrate();   // once, at start-up
+        ...
+        HAL::Sleep::TimedSleep::sleepFor(5000);
+ *
+ * `sleepFor` starts a watchdog period (the longest one that fits in the
+ * requested time) and goes to sleep. The watchdog interrupt closes the
+ * period: a whole period of real time went by, and whatever part of it
+ * Timer0 counted was time spent awake, so the rest is added to the
+ * ticker with `HAL::Ticker::advance`.
+ *
+ * If something else (a PCINT, say) wakes the MCU first, `sleepFor`
+ * returns straight away and the partial period is measured the same way:
+ * the watchdog keeps running, and when it fires (with the MCU awake or
+ * asleep again) the slept part is the period minus what Timer0 counted in
+ * the meantime. Until then the ticker is behind by however long the MCU
+ * slept (`compensationPending()`), and it jumps forward when the watchdog
+ * fires.
+ *
+ * The watchdog's 128 kHz oscillator is only good to ~10% (and moves with
+ * voltage and temperature), so `calibrate()` times a few watchdog periods
+ * against Timer0 (which runs off the crystal) and uses that from then on.
+ *
+ * This owns the watchdog: don't combine it with HAL::Watchdog::Watchdog<>,
+ * HAL::Watchdog::Scheduler or another WDT_vect.
+ */
+
+struct TimedSleep {
+
+    // real length of the shortest (2048-cycle) watchdog period
+    static inline uint16_t baseUs { 16000 };
+
+    static inline volatile bool                      running      { false };
+    static inline volatile bool                      calibrating  { false };
+    static inline volatile uint8_t                   wakeups      { 0 };
+    static inline volatile uint8_t                   periodPow    { 11 };
+    static inline volatile HAL::Ticker::Timestamp    periodStart  { 0, 0 };
+    static inline volatile uint16_t                  remainderUs  { 0 };
+
+    static inline uint32_t periodUs(uint8_t powOfTwo) {
+        return static_cast<uint32_t>(baseUs) << (powOfTwo - 11);
+    }
+
+    // microseconds Timer0 counted between two snapshots (saturating)
+    static inline uint32_t elapsedUs(HAL::Ticker::Timestamp from,
+                                     HAL::Ticker::Timestamp to) {
+        uint32_t ms = to.ms - from.ms;
+        if (ms > 0x3FFFFF) return 0xFFFFFFFF;
+        return ms * 1000UL + to.us - from.us;
+    }
+
+    static inline HAL::Ticker::Timestamp loadPeriodStart() {
+        return { periodStart.ms, periodStart.us };
+    }
+
+    static inline void storePeriodStart(HAL::Ticker::Timestamp t) {
+        periodStart.ms = t.ms;
+        periodStart.us = t.us;
+    }
+
+    // call this (and only this) from ISR(WDT_vect)
+    static inline void onWatchdogInterrupt() {
+        HAL::Ticker::Timestamp now = HAL::Ticker::getTimestamp();
+        wakeups = wakeups + 1;
+        if (calibrating) {
+            storePeriodStart(now);
+            return;
+        }
+        if (!running) return;
+
+        uint32_t awake  = elapsedUs(loadPeriodStart(), now);
+        uint32_t period = periodUs(periodPow);
+        if (awake < period) {
+            uint32_t slept = (period - awake) + remainderUs;
+            uint32_t ms    = 0;
+            while (slept >= 1000000UL) { ms += 1000; slept -= 1000000UL; }
+            while (slept >= 1000)      { ms += 1;    slept -= 1000;     }
+            remainderUs = static_cast<uint16_t>(slept);
+            HAL::Ticker::advance(ms);
+        }
+        running = false;
+        HAL::Watchdog::stop();
+    }
+
+    // true while a sleep that ended early hasn't been accounted for yet
+    static inline bool compensationPending() {
+        return running;
+    }
+
+    /**
+     * Starts a watchdog period of (at most) `maxMs` to be accounted for,
+     * if one isn't running already; false if `maxMs` is shorter than the
+     * shortest watchdog period
+     */
+    static bool start(uint32_t maxMs) {
+        if (running) return true;
+
+        uint8_t pow { 0 };
+        uint32_t maxUs = (maxMs > 4000000UL) ? 0xFFFFFFFF : maxMs * 1000UL;
+        for (uint8_t p = 20; p >= 11; --p) {
+            if (periodUs(p) <= maxUs) { pow = p; break; }
+        }
+        if (!pow) return false;
+
+        ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+            periodPow = pow;
+            storePeriodStart(HAL::Ticker::getTimestamp());
+            running = true;
+            HAL::Watchdog::startInterruptMode(
+                    HAL::Watchdog::getWDPrescalerBits(pow));
+        }
+        return true;
+    }
+
+    /**
+     * Sleeps in `mode` for (at most) `maxMs`; returns true if the full
+     * watchdog period elapsed, false if something else woke us up. If
+     * `maxMs` is shorter than the shortest watchdog period, it idles
+     * instead (Timer0 keeps running so nothing needs compensating)
+     */
+    static bool sleepFor(uint32_t maxMs, uint8_t mode=SLEEP_MODE_PWR_DOWN) {
+        uint8_t before { wakeups };
+
+        if (!start(maxMs)) {
+            goToSleep(SLEEP_MODE_IDLE);
+            return false;
+        }
+
+        goToSleep(mode);
+        return wakeups != before && !running;
+    }
+
+    /**
+     * Time `periods` watchdog periods against Timer0 and use that from now
+     * on. Blocks (with interrupts on and the ticker running) for about
+     * `periods` * 128 ms
+     */
+    static void calibrate(uint8_t periods=4) {
+        constexpr uint8_t pow { 14 };   // ~128 ms
+        if (periods == 0) periods = 1;
+
+        running     = false;
+        calibrating = true;
+        uint8_t start = wakeups;
+        HAL::Watchdog::startInterruptMode(HAL::Watchdog::getWDPrescalerBits(pow));
+
+        // the first interrupt marks the start so that we don't depend on
+        // how long the watchdog took to restart
+        while (wakeups == start) { }
+        HAL::Ticker::Timestamp first = loadPeriodStart();
+        while (static_cast<uint8_t>(wakeups - start) <= periods) { }
+        HAL::Ticker::Timestamp last = loadPeriodStart();
+
+        HAL::Watchdog::stop();
+        calibrating = false;
+
+        uint32_t perPeriod = elapsedUs(first, last) / periods;
+        baseUs = static_cast<uint16_t>(perPeriod >> (pow - 11));
+    }
+};
+
+#define HAL_SLEEP_WDT_ISR()                               \
+    ISR(WDT_vect) {                                       \
+        HAL::Sleep::TimedSleep::onWatchdogInterrupt();    \
+    }
+
+/**
+ * Picks the deepest sleep mode nothing objects to
+ *
+ * Instead of every sketch working out whether a debounce window, a UART
+ * transmission or a due timer rules out power-down, each of them
+ * registers a constraint: a function that says whether it's busy, the
+ * deepest sleep it can stand while it is, and the peripherals (PRR bits)
+ * it needs clocked meanwhile
+ *
+        using Governor = HAL::Sleep::Governor<>;
+
+        Governor::add(Tx::txBusy, HAL::Sleep::Depth::IDLE, (1 << PRUSART0));
+        Governor::add([] { return button.pendingDebounceTimeout(); },
+                      HAL::Sleep::Depth::IDLE);
+        Governor::add([] { return timers.ticksUntilNext() < 20; },
+                      HAL::Sleep::Depth::IDLE);
+        Governor::setGated((1 << PRTWI) | (1 << PRSPI) | (1 << PRADC));
+        ...
+        for (;;) {
+            ...
+            Governor::sleepFor(timers.ticksUntilNext());
+        }
+ *
+ * The depths, shallowest first, are IDLE (everything but the CPU keeps
+ * running), ADC (ADC noise reduction: the ADC, Timer2 in asynchronous
+ * mode, TWI address match, the watchdog and external/pin change
+ * interrupts), POWER_SAVE (power-down plus asynchronous Timer2; there's
+ * no such mode on the tiny85, where it's the same as POWER_DOWN) and
+ * POWER_DOWN. Anything but IDLE stops Timer0 and so the ticker.
+ *
+ * `sleep()` goes to the deepest depth every busy constraint allows,
+ * with the gated peripherals switched off in PRR (except the ones a busy
+ * constraint keeps) and turned back on when it wakes. Gating the ADC
+ * disables it first and re-enables it after, as the datasheet asks. Only
+ * the bits the governor set itself are undone, so whatever an ISR did to
+ * PRR or ADCSRA in the meantime stays done. The interrupt that wakes the
+ * MCU runs before the sleep instruction returns, though, so it runs with
+ * the gated peripherals still off: turn one back on in PRR (and set ADEN
+ * for the ADC) before using it from there. For
+ * POWER_SAVE and POWER_DOWN the brown-out detector is switched off for
+ * the duration where the MCU can do that.
+ *
+ * `sleepFor(maxMs)` does the same, but anything deeper than IDLE goes
+ * through HAL::Sleep::TimedSleep, so the ticker is brought up to date for
+ * the time spent asleep (needs HAL_SLEEP_WDT_ISR and owns the watchdog;
+ * see TimedSleep). If `maxMs` is less than a watchdog period it idles.
+ *
+ * The constraints are checked with interrupts off, right up to the sleep
+ * instruction, so an interrupt that makes something busy either happens
+ * before the check or wakes the MCU straight back up.
+ */
+
+enum class Depth : uint8_t { IDLE, ADC, POWER_SAVE, POWER_DOWN };
+
+template<uint8_t capacity=8>
+struct Governor {
+
+    static_assert(capacity > 0, "Governor needs room for at least one constraint");
+
+    struct Constraint {
+        bool  (*busy)();
+        Depth limit;
+        uint8_t keepOn;     // PRR bits to leave clocked while busy
+    };
+
+    static inline Constraint constraints[capacity] { };
+    static inline uint8_t    count                 { 0 };
+    static inline uint8_t    gated                 { 0 };
+
+    // false if the list is full
+    static bool add(bool (*busy)(), Depth limit, uint8_t keepOn=0) {
+        if (count == capacity) return false;
+        constraints[count++] = { busy, limit, keepOn };
+        return true;
+    }
+
+    // PRR bits to switch off while asleep
+    static void setGated(uint8_t prrBits) { gated = prrBits; }
+
+    static uint8_t mode(Depth depth) {
+        switch (depth) {
+            case Depth::IDLE:       return SLEEP_MODE_IDLE;
+            case Depth::ADC:        return SLEEP_MODE_ADC;
+#if defined(SLEEP_MODE_PWR_SAVE)
+            case Depth::POWER_SAVE: return SLEEP_MODE_PWR_SAVE;
+#endif
+            default:                return SLEEP_MODE_PWR_DOWN;
+        }
+    }
+
+    // the deepest depth allowed right now, and the PRR bits to gate
+    static Depth evaluate(uint8_t& gate) {
+        Depth   depth  { Depth::POWER_DOWN };
+        uint8_t keepOn { 0 };
+        for (uint8_t i = 0; i < count; ++i) {
+            const Constraint& c = constraints[i];
+            if (c.busy && c.busy()) {
+                if (c.limit < depth) depth = c.limit;
+                keepOn |= c.keepOn;
+            }
+        }
+        gate = gated & static_cast<uint8_t>(~keepOn);
+        return depth;
+    }
+
+    static Depth deepestAllowed() {
+        uint8_t gate;
+        Depth   depth;
+        ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+            depth = evaluate(gate);
+        }
+        return depth;
+    }
+
+    // with interrupts off; comes back with them on
+    static void enter(Depth depth, uint8_t gate) {
+        // only what's on now gets switched off (and back on)
+        gate &= static_cast<uint8_t>(~PRR);
+        bool adcOff = (gate & (1 << PRADC)) && (ADCSRA & (1 << ADEN));
+        if (adcOff) ADCSRA &= ~(1 << ADEN);
+        PRR |= gate;
+
+        set_sleep_mode(mode(depth));
+        sleep_enable();
+#if defined(BODS) && defined(BODSE)
+        if (depth >= Depth::POWER_SAVE)
+            sleep_bod_disable();
+#endif
+        sei();
+        sleep_cpu();
+        sleep_disable();
+
+        // the waking ISR has run; leave whatever it changed alone
+        cli();
+        PRR &= static_cast<uint8_t>(~gate);
+        if (adcOff) ADCSRA |= (1 << ADEN);
+        sei();
+    }
+
+    // sleeps as deep as allowed until an interrupt; returns the depth
+    static Depth sleep() {
+        cli();
+        uint8_t gate;
+        Depth   depth = evaluate(gate);
+        enter(depth, gate);
+        return depth;
+    }
+
+    // the same, keeping the ticker right; see above
+    static Depth sleepFor(uint32_t maxMs) {
+        cli();
+        uint8_t gate;
+        Depth   depth = evaluate(gate);
+        if (depth != Depth::IDLE && !TimedSleep::start(maxMs))
+            depth = Depth::IDLE;
+        enter(depth, gate);
+        return depth;
+    }
+};
+
+
+
 }
 }
@@ -0,0 +1,476 @@
+#pragma once
+
+#include "common.hpp"
+#include "gpio.hpp"
+#include "pwm.hpp"
+
+#include <stdint.h>
+#include <util/atomic.h>
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include <avr/pgmspace.h>
+
+/**
+ * SOFTPWM
+ *
+ * 8-bit PWM on any GPIO pins, from a timer's interrupts, with fades
+ *
+        using Leds = HAL::SoftPWM::Driver<200, HAL::SoftPWM::gamma28,
+                                          14, 15, 16, 23, 24>;
+        HAL_SOFTPWM_ISR(Leds)
+
+        Leds::begin();
+        sei();
+        Leds::write(0, 128);            // channel 0 (pin 14) at half brightness
+        Leds::fadeTo(1, 255, 1500);     // channel 1 up to full over 1.5 s
+        if (!Leds::fading(1)) ...
+ *
+ * Channels are numbered in the order the pins are listed (up to 16).
+ * The timer (Timer2 on the ATmega328P, Timer1 on the ATtiny85; neither
+ * is then available to HAL::PWM) counts 0 to 255 in normal mode. The
+ * overflow interrupt starts a period by switching every channel that's
+ * not at 0 on; the compare match interrupt is then only scheduled for
+ * the counts where something turns off.
+ *
+ * Rather than look at each pin on every tick, the channels are kept
+ * sorted by duty, and each distinct duty value becomes one entry in a
+ * schedule along with the complete output byte of every port the pins
+ * are on (grouped the same way as HAL::GPIO::PinGroup). Each interrupt
+ * is then one read-modify-write store per port: all the pins on a port
+ * change together, and the work per period is O(distinct duties), not
+ * O(pins) and not O(ticks). Other pins on the same ports keep their
+ * level, as long as the main loop changes them with single sbi/cbi
+ * (HAL::GPIO) or in ATOMIC_BLOCKs.
+ *
+ * The prescaler is the slowest one that still gives at least
+ * `minFrequencyHz` periods a second; `actualHz` is what it comes out
+ * as. (At 16 MHz: 200 gives 244 Hz, with one tick every 256 cycles.)
+ * Duties closer together than the interrupt takes are handled in the
+ * same interrupt; a pin can turn off up to a tick early or late.
+ *
+ * Levels go through `gammaTable` (in PROGMEM; nullptr for none) on
+ * their way to the duty, so that equal steps in level look like equal
+ * steps in brightness, and fades are linear in level. With gamma28,
+ * levels below 28 are off.
+ *
+ * `write()` and `fadeTo()` return straight away; the new schedule is
+ * worked out at the end of the next overflow interrupt, with interrupts
+ * enabled again (so the compare match and the ticker aren't held up),
+ * and takes over the period after that. Fades step every period, from
+ * the overflow interrupt, so they keep going however long the main loop
+ * blocks for.
+ */
+
+namespace HAL {
+namespace SoftPWM {
+
+// round(255 * (i / 255) ^ 2.2)
+inline const uint8_t gamma22[256] PROGMEM = {
+      0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   1,
+      1,   1,   1,   1,   1,   1,   1,   1,   1,   2,   2,   2,   2,   2,   2,   2,
+      3,   3,   3,   3,   3,   4,   4,   4,   4,   5,   5,   5,   5,   6,   6,   6,
+      6,   7,   7,   7,   8,   8,   8,   9,   9,   9,  10,  10,  11,  11,  11,  12,
+     12,  13,  13,  13,  14,  14,  15,  15,  16,  16,  17,  17,  18,  18,  19,  19,
+     20,  20,  21,  22,  22,  23,  23,  24,  25,  25,  26,  26,  27,  28,  28,  29,
+     30,  30,  31,  32,  33,  33,  34,  35,  35,  36,  37,  38,  39,  39,  40,  41,
+     42,  43,  43,  44,  45,  46,  47,  48,  49,  49,  50,  51,  52,  53,  54,  55,
+     56,  57,  58,  59,  60,  61,  62,  63,  64,  65,  66,  67,  68,  69,  70,  71,
+     73,  74,  75,  76,  77,  78,  79,  81,  82,  83,  84,  85,  87,  88,  89,  90,
+     91,  93,  94,  95,  97,  98,  99, 100, 102, 103, 105, 106, 107, 109, 110, 111,
+    113, 114, 116, 117, 119, 120, 121, 123, 124, 126, 127, 129, 130, 132, 133, 135,
+    137, 138, 140, 141, 143, 145, 146, 148, 149, 151, 153, 154, 156, 158, 159, 161,
+    163, 165, 166, 168, 170, 172, 173, 175, 177, 179, 181, 182, 184, 186, 188, 190,
+    192, 194, 196, 197, 199, 201, 203, 205, 207, 209, 211, 213, 215, 217, 219, 221,
+    223, 225, 227, 229, 231, 234, 236, 238, 240, 242, 244, 246, 248, 251, 253, 255,
+};
+
+// round(255 * (i / 255) ^ 2.8), closer to how LEDs look
+inline const uint8_t gamma28[256] PROGMEM = {
+      0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,
+      0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   1,   1,   1,   1,
+      1,   1,   1,   1,   1,   1,   1,   1,   1,   2,   2,   2,   2,   2,   2,   2,
+      2,   3,   3,   3,   3,   3,   3,   3,   4,   4,   4,   4,   4,   5,   5,   5,
+      5,   6,   6,   6,   6,   7,   7,   7,   7,   8,   8,   8,   9,   9,   9,  10,
+     10,  10,  11,  11,  11,  12,  12,  13,  13,  13,  14,  14,  15,  15,  16,  16,
+     17,  17,  18,  18,  19,  19,  20,  20,  21,  21,  22,  22,  23,  24,  24,  25,
+     25,  26,  27,  27,  28,  29,  29,  30,  31,  32,  32,  33,  34,  35,  35,  36,
+     37,  38,  39,  39,  40,  41,  42,  43,  44,  45,  46,  47,  48,  49,  50,  50,
+     51,  52,  54,  55,  56,  57,  58,  59,  60,  61,  62,  63,  64,  66,  67,  68,
+     69,  70,  72,  73,  74,  75,  77,  78,  79,  81,  82,  83,  85,  86,  87,  89,
+     90,  92,  93,  95,  96,  98,  99, 101, 102, 104, 105, 107, 109, 110, 112, 114,
+    115, 117, 119, 120, 122, 124, 126, 127, 129, 131, 133, 135, 137, 138, 140, 142,
+    144, 146, 148, 150, 152, 154, 156, 158, 160, 162, 164, 167, 169, 171, 173, 175,
+    177, 180, 182, 184, 186, 189, 191, 193, 196, 198, 200, 203, 205, 208, 210, 213,
+    215, 218, 220, 223, 225, 228, 231, 233, 236, 239, 241, 244, 247, 249, 252, 255,
+};
+
+// also handy for HAL::PWM: write(gamma(level, gamma28))
+inline uint8_t gamma(uint8_t level, const uint8_t* table) {
+    return table ? pgm_read_byte(&table[level]) : level;
+}
+
+struct Prescaler {
+    uint16_t prescaler;
+    uint8_t  csBits;
+};
+
+// the slowest clock that still gives at least minFrequencyHz periods of
+// 256 ticks
+constexpr Prescaler choosePrescaler(uint32_t minFrequencyHz) {
+    Prescaler best { 0, 0 };
+#if defined(__AVR_ATmega328P__)
+    for (auto& opt: HAL::PWMTimers::timer2_prescaler_options) {
+        if (F_CPU / (opt.prescaler * 256UL) >= minFrequencyHz)
+            best = { opt.prescaler, opt.cs_bits };
+    }
+#elif defined(__AVR_ATtiny85__)
+    for (uint8_t cs = 1; cs <= 15; ++cs) {
+        uint32_t prescaler = 1UL << (cs - 1);
+        if (F_CPU / (prescaler * 256UL) >= minFrequencyHz)
+            best = { static_cast<uint16_t>(prescaler), cs };
+    }
+#endif
+    return best;
+}
+
+template<uint16_t       minFrequencyHz,
+         const uint8_t* gammaTable,
+         uint8_t...     physicalPins>
+struct Driver {
+
+    using Group = HAL::GPIO::PinGroup<physicalPins...>;
+    using Port  = HAL::GPIO::Port;
+
+    static constexpr uint8_t count { sizeof...(physicalPins) };
+    static constexpr uint8_t pins[] { physicalPins... };
+
+    static_assert(count >= 1 && count <= 16, "SoftPWM drives 1 to 16 pins");
+
+    static constexpr Prescaler clock { choosePrescaler(minFrequencyHz) };
+
+    static_assert(clock.prescaler != 0, "minFrequencyHz is too high for 8-bit software PWM");
+    // the compare match interrupt has to get a word in between ticks
+    static_assert(clock.prescaler >= 32, "minFrequencyHz is too high for the interrupts to keep up");
+
+    static constexpr uint32_t actualHz { F_CPU / (clock.prescaler * 256UL) };
+
+    static constexpr bool usesPort(Port port) {
+        for (uint8_t i = 0; i < count; ++i)
+            if (HAL::GPIO::pinTable[pins[i] - 1].port == port) return true;
+        return false;
+    }
+
+    // index of `port` in the output bytes: only the ports in use get one
+    static constexpr uint8_t portIndex(Port port) {
+        uint8_t index { 0 };
+        for (uint8_t p = 0; p < static_cast<uint8_t>(port); ++p)
+            if (usesPort(static_cast<Port>(p))) ++index;
+        return index;
+    }
+
+    static constexpr uint8_t ports { portIndex(Port::Invalid) };
+
+    struct Channel {
+        uint8_t index;      // into the output bytes
+        uint8_t mask;
+    };
+
+    static constexpr Channel channelAt(uint8_t i) {
+        HAL::GPIO::PinInfo info = HAL::GPIO::pinTable[pins[i] - 1];
+        return { portIndex(info.port), static_cast<uint8_t>(1 << info.bit) };
+    }
+
+    struct Event {
+        uint8_t at;             // timer count
+        uint8_t levels[ports];  // every port's pins from then on
+    };
+
+    struct Schedule {
+        uint8_t start[ports];
+        uint8_t length;
+        Event   events[count];
+    };
+
+    struct Fade {
+        uint16_t value;         // 8.8 level
+        int16_t  step;          // per period
+        uint16_t left;          // periods
+        uint8_t  target;
+    };
+
+    static inline Schedule schedules[2] { };
+    static inline volatile uint8_t active   { 0 };
+    static inline volatile bool    ready    { false };
+    static inline volatile bool    dirty    { false };
+    static inline bool             building { false };
+    static inline uint8_t          next     { 0 };     // index in the active schedule's events
+
+    static inline uint8_t level[count] { };
+    static inline uint8_t duty[count]  { };
+    static inline uint8_t order[count] { };   // channels, in order of duty
+    static inline Fade    fades[count] { };
+    static inline volatile uint8_t fadesLeft { 0 };
+
+    static inline volatile uint8_t& counter() {
+#if defined(__AVR_ATmega328P__)
+        return TCNT2;
+#elif defined(__AVR_ATtiny85__)
+        return TCNT1;
+#endif
+    }
+
+    static inline volatile uint8_t& compare() {
+#if defined(__AVR_ATmega328P__)
+        return OCR2A;
+#elif defined(__AVR_ATtiny85__)
+        return OCR1A;
+#endif
+    }
+
+    template<Port port>
+    static inline void storePort(const uint8_t* levels) {
+        constexpr uint8_t m = Group::template portMask<port>();
+        if constexpr (m != 0) {
+            volatile uint8_t& reg = HAL::GPIO::PortRegisters<port>::port();
+            reg = (reg & static_cast<uint8_t>(~m)) | levels[portIndex(port)];
+        }
+    }
+
+    static inline void store(const uint8_t* levels) {
+        storePort<Port::B>(levels);
+#if defined(__AVR_ATmega328P__)
+        storePort<Port::C>(levels);
+        storePort<Port::D>(levels);
+#endif
+    }
+
+    static void begin() {
+        for (uint8_t i = 0; i < count; ++i) {
+            level[i] = 0;
+            duty[i]  = 0;
+            order[i] = i;
+            fades[i] = { };
+        }
+        schedules[0] = { };
+        schedules[1] = { };
+        Group::write(0);
+        Group::setOutput();
+
+        ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+            active    = 0;
+            ready     = false;
+            dirty     = false;
+            building  = false;
+            next      = 0;
+            fadesLeft = 0;
+#if defined(__AVR_ATmega328P__)
+            TCCR2A = 0;
+            TCCR2B = clock.csBits;
+            TCNT2  = 0;
+            TIFR2  = (1 << OCF2A) | (1 << TOV2);
+            TIMSK2 = (1 << OCIE2A) | (1 << TOIE2);
+#elif defined(__AVR_ATtiny85__)
+            TCCR1  = clock.csBits;
+            TCNT1  = 0;
+            TIFR   = (1 << OCF1A) | (1 << TOV1);
+            TIMSK |= (1 << OCIE1A) | (1 << TOIE1);
+#endif
+        }
+    }
+
+    // timer stopped, pins low (and still outputs)
+    static void end() {
+        ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+#if defined(__AVR_ATmega328P__)
+            TIMSK2 = 0;
+            TCCR2B = 0;
+#elif defined(__AVR_ATtiny85__)
+            TIMSK &= ~((1 << OCIE1A) | (1 << TOIE1));
+            TCCR1  = 0;
+#endif
+        }
+        Group::write(0);
+    }
+
+    // runs every event that's due (or nearly), then sets the compare
+    // match up for the next one
+    static inline void runDue() {
+        const Schedule& s = schedules[active];
+        uint8_t i = next;
+        while (i < s.length) {
+            uint8_t at = s.events[i].at;
+            // within a tick is as good as due: setting OCR to the count
+            // that's about to happen might miss it
+            if (at > static_cast<uint16_t>(counter()) + 1) {
+                compare() = at;
+                break;
+            }
+            store(s.events[i].levels);
+            ++i;
+        }
+        next = i;
+    }
+
+    // call this (and only this) from the timer's compare match A ISR
+    static inline void onCompareMatch() {
+        runDue();
+    }
+
+    // call this (and only this) from the timer's overflow ISR
+    static inline void onOverflow() {
+        if (ready) {
+            active = active ^ 1;
+            ready  = false;
+        }
+        store(schedules[active].start);
+        next = 0;
+        runDue();
+
+        if (building || !(dirty || fadesLeft)) return;
+        building = true;
+        // the rest can wait for the compare matches
+        sei();
+        if (fadesLeft) stepFades();
+        if (dirty) build();
+        cli();
+        building = false;
+    }
+
+    static inline uint8_t dutyOf(uint8_t lvl) { return gamma(lvl, gammaTable); }
+
+    static void stepFades() {
+        uint8_t stillGoing { 0 };
+        for (uint8_t i = 0; i < count; ++i) {
+            Fade& f = fades[i];
+            if (!f.left) continue;
+            if (--f.left) {
+                f.value += f.step;
+                ++stillGoing;
+            } else {
+                f.value = static_cast<uint16_t>(f.target) << 8;
+            }
+            uint8_t lvl = f.value >> 8;
+            if (lvl != level[i]) {
+                level[i] = lvl;
+                duty[i]  = dutyOf(lvl);
+                dirty    = true;
+            }
+        }
+        fadesLeft = stillGoing;
+    }
+
+    // into the schedule that isn't active, to take over next period
+    static void build() {
+        dirty = false;
+
+        // insertion sort: the order hardly changes from one build to the
+        // next, so this is ~count comparisons
+        for (uint8_t i = 1; i < count; ++i) {
+            uint8_t channel = order[i];
+            uint8_t d       = duty[channel];
+            uint8_t j       = i;
+            while (j > 0 && duty[order[j - 1]] > d) {
+                order[j] = order[j - 1];
+                --j;
+            }
+            order[j] = channel;
+        }
+
+        Schedule& s = schedules[active ^ 1];
+        uint8_t levels[ports] { };
+        for (uint8_t i = 0; i < count; ++i) {
+            if (duty[i]) levels[channelAt(i).index] |= channelAt(i).mask;
+        }
+        for (uint8_t p = 0; p < ports; ++p) s.start[p] = levels[p];
+
+        // 0 never turns on and 255 never turns off, so neither needs an event
+        uint8_t length { 0 };
+        for (uint8_t k = 0; k < count; ++k) {
+            uint8_t channel = order[k];
+            uint8_t d       = duty[channel];
+            if (d == 0)   continue;
+            if (d == 255) break;
+            levels[channelAt(channel).index] &= static_cast<uint8_t>(~channelAt(channel).mask);
+            if (!length || s.events[length - 1].at != d) ++length;
+            Event& e = s.events[length - 1];
+            e.at = d;
+            for (uint8_t p = 0; p < ports; ++p) e.levels[p] = levels[p];
+        }
+        s.length = length;
+        ready    = true;
+    }
+
+    // 0 (off) to 255 (on), through the gamma table; stops any fade
+    static void write(uint8_t channel, uint8_t lvl) {
+        if (channel >= count) return;
+        ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+            fades[channel].left = 0;
+            level[channel]      = lvl;
+            duty[channel]       = dutyOf(lvl);
+            dirty               = true;
+        }
+    }
+
+    static uint8_t read(uint8_t channel) {
+        if (channel >= count) return 0;
+        uint8_t lvl;
+        ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+            lvl = level[channel];
+        }
+        return lvl;
+    }
+
+    // from wherever it is now to `target`, over about `ms`
+    static void fadeTo(uint8_t channel, uint8_t target, uint16_t ms) {
+        if (channel >= count) return;
+        uint32_t periods = static_cast<uint32_t>(ms) * actualHz / 1000;
+        if (periods > 0xFFFF) periods = 0xFFFF;
+        if (periods < 2) {
+            write(channel, target);
+            return;
+        }
+        ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+            Fade& f   = fades[channel];
+            if (!f.left) fadesLeft = fadesLeft + 1;
+            f.value   = static_cast<uint16_t>(level[channel]) << 8;
+            f.target  = target;
+            f.step    = static_cast<int16_t>(
+                    ((static_cast<int32_t>(target) << 8) - f.value)
+                    / static_cast<int32_t>(periods));
+            f.left    = static_cast<uint16_t>(periods);
+        }
+    }
+
+    static inline bool fading(uint8_t channel) {
+        if (channel >= count) return false;
+        bool left;
+        ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+            left = fades[channel].left != 0;
+        }
+        return left;
+    }
+
+    static inline bool fading() { return fadesLeft != 0; }
+};
+
+#if defined(__AVR_ATtiny85__)
+#define HAL_SOFTPWM_ISR(Pwm)                  \
+    ISR(TIM1_COMPA_vect) {                    \
+        Pwm::onCompareMatch();                \
+    }                                         \
+    ISR(TIM1_OVF_vect) {                      \
+        Pwm::onOverflow();                    \
+    }
+#elif defined(__AVR_ATmega328P__)
+#define HAL_SOFTPWM_ISR(Pwm)                  \
+    ISR(TIMER2_COMPA_vect) {                  \
+        Pwm::onCompareMatch();                \
+    }                                         \
+    ISR(TIMER2_OVF_vect) {                    \
+        Pwm::onOverflow();                    \
+    }
+#endif
+
+
+}
+}
@@ -0,0 +1,362 @@
+#pragma once
+
+#include "common.hpp"
+#include "gpio.hpp"
+#include "utils/RingBuffer.hpp"
+
+#include <stdint.h>
+#include <util/atomic.h>
+#include <util/delay_basic.h>
+#include <avr/io.h>
+#include <avr/interrupt.h>
+
+/**
+ * SPI
+ *
+ * SPI master, on the SPI peripheral of the ATmega328P or the USI of the
+ * ATtiny85 (three-wire mode)
+ *
+        using Bus   = HAL::SPI::Bus<4000000>;              // SCK at most 4 MHz
+        using Flash = HAL::SPI::Device<Bus, 16>;           // CS on pin 16
+        HAL_SPI_ISR(Bus)
+
+        Bus::begin();
+        Flash::begin();
+        uint8_t id = Flash::transfer(0x9F);                // blocking
+
+        static const uint8_t command[] { 0x03, 0x00, 0x10, 0x00 };
+        static uint8_t page[256];
+        Flash::queue(command, nullptr, sizeof(command), nullptr, false);
+        Flash::queue(nullptr, page, sizeof(page), onPageRead);
+ *
+ * The clock divider is worked out at compile time: the smallest one
+ * (2 to 128 on the ATmega328P) that keeps SCK at or under `maxClockHz`.
+ * `clockHz` is what it comes out as.
+ *
+ * Queued transfers run from the serial transfer complete interrupt, one
+ * byte per interrupt, over the caller's buffers (which have to stay put
+ * until the callback): `tx` nullptr sends 0xFF, `rx` nullptr throws what
+ * comes back away. The device is selected for each transfer and, unless
+ * `release` is false, deselected at the end of it, which lets a command
+ * and its data go out as two transfers under one chip select. `done`
+ * is then called from the ISR, and may queue the next transfer. `queue`
+ * returns false when all `queueSize` slots are taken.
+ *
+ * The blocking transfers wait for the queue to drain first, so don't
+ * call them from a callback.
+ *
+ * On the ATmega328P, SS (pin 16) is made an output (an input that went
+ * low would drop the SPI out of master mode), so use it as a chip
+ * select or leave it alone. MOSI is pin 17, MISO 18 and SCK 19.
+ *
+ * On the ATtiny85, DO is pin 6 (PB1), DI pin 5 (PB0) and USCK pin 7
+ * (PB2). The USI has no clock of its own (its only timer clock is
+ * Timer0's compare match, which belongs to HAL::Ticker), so the CPU
+ * strobes USCK 16 times a byte, with a busy-wait in between to stay
+ * under `maxClockHz`; F_CPU / 10 at the most. That makes every transfer
+ * blocking: `queue` runs the transfer and calls `done` before it
+ * returns. LSB_FIRST is done by reversing the bits, since the USI only
+ * shifts MSB first.
+ *
+ * `busy()` is true while a queued transfer is in progress, for
+ * HAL::Sleep::Governor (the SPI stops in anything deeper than idle).
+ */
+
+namespace HAL {
+namespace SPI {
+
+// CPOL is bit 1, CPHA bit 0
+enum class Mode : uint8_t { MODE0, MODE1, MODE2, MODE3 };
+
+enum class BitOrder : uint8_t { MSB_FIRST, LSB_FIRST };
+
+struct Transfer {
+    const uint8_t* tx;
+    uint8_t*       rx;
+    uint16_t       length;
+    Callback       select;
+    Callback       deselect;    // nullptr keeps the device selected
+    Callback       done;
+};
+
+#if defined(__AVR_ATmega328P__)
+
+struct Divider {
+    uint8_t divider;
+    uint8_t sprBits;
+    bool    doubleSpeed;
+};
+
+constexpr Divider dividerOptions[] = {
+    {2,   0,                           true },
+    {4,   0,                           false},
+    {8,   (1 << SPR0),                 true },
+    {16,  (1 << SPR0),                 false},
+    {32,  (1 << SPR1),                 true },
+    {64,  (1 << SPR1),                 false},
+    {128, (1 << SPR1) | (1 << SPR0),   false}
+};
+
+// the smallest divider that keeps SCK at or under maxClockHz (else 128)
+constexpr Divider chooseDivider(uint32_t maxClockHz) {
+    for (auto& opt: dividerOptions) {
+        if (F_CPU / opt.divider <= maxClockHz) return opt;
+    }
+    return dividerOptions[6];
+}
+
+#elif defined(__AVR_ATtiny85__)
+
+// cycles per USCK toggle in the strobe loop, without any delay
+constexpr uint16_t strobeCycles { 5 };
+
+// _delay_loop_1 iterations (3 cycles each) per half clock
+constexpr uint16_t strobeDelay(uint32_t maxClockHz) {
+    uint32_t half = (F_CPU + 2 * maxClockHz - 1) / (2 * maxClockHz);
+    return (half > strobeCycles) ? (half - strobeCycles + 2) / 3 : 0;
+}
+
+#endif
+
+constexpr uint8_t reverseBits(uint8_t b) {
+    b = static_cast<uint8_t>((b >> 4) | (b << 4));
+    b = static_cast<uint8_t>(((b & 0xCC) >> 2) | ((b & 0x33) << 2));
+    return static_cast<uint8_t>(((b & 0xAA) >> 1) | ((b & 0x55) << 1));
+}
+
+template<uint32_t maxClockHz,
+         Mode     mode=Mode::MODE0,
+         BitOrder order=BitOrder::MSB_FIRST,
+         uint8_t  queueSize=4>
+struct Bus {
+
+    static_assert(maxClockHz > 0, "maxClockHz must be > 0");
+
+    static constexpr bool cpol { (static_cast<uint8_t>(mode) & 2) != 0 };
+    static constexpr bool cpha { (static_cast<uint8_t>(mode) & 1) != 0 };
+
+#if defined(__AVR_ATmega328P__)
+    static constexpr Divider divider { chooseDivider(maxClockHz) };
+    static constexpr uint32_t clockHz { F_CPU / divider.divider };
+
+    using SS   = HAL::GPIO::GPIO<16>;
+    using MOSI = HAL::GPIO::GPIO<17>;
+    using MISO = HAL::GPIO::GPIO<18>;
+    using SCK  = HAL::GPIO::GPIO<19>;
+#elif defined(__AVR_ATtiny85__)
+    static constexpr uint16_t delay { strobeDelay(maxClockHz) };
+    static_assert(delay <= 255, "maxClockHz is too low for the USI strobe loop");
+    static constexpr uint32_t clockHz { F_CPU / (2 * (strobeCycles + 3 * delay)) };
+
+    using DI   = HAL::GPIO::GPIO<5>;
+    using DO   = HAL::GPIO::GPIO<6>;
+    using USCK = HAL::GPIO::GPIO<7>;
+
+    // three-wire mode, software clock strobe; USICS0 picks the edge DI
+    // is sampled on (0 is rising)
+    static constexpr uint8_t strobe {
+        (1 << USIWM0) | (1 << USICS1) | ((cpol != cpha) ? (1 << USICS0) : 0)
+        | (1 << USICLK) | (1 << USITC)
+    };
+#endif
+
+    static inline HAL::Utils::RingBuffer<Transfer, queueSize> pending;
+    static inline Transfer          current { };
+    static inline uint16_t          index   { 0 };
+    static inline volatile bool     active  { false };
+
+    static void begin() {
+#if defined(__AVR_ATmega328P__)
+        PRR &= ~(1 << PRSPI);
+        if (!(DDRB & SS::mask)) {
+            SS::setHigh();
+            SS::setOutput();
+        }
+        MOSI::setOutput();
+        SCK::setOutput();
+        MISO::setInput();
+        SPCR = (1 << SPE) | (1 << MSTR)
+             | ((order == BitOrder::LSB_FIRST) ? (1 << DORD) : 0)
+             | (cpol ? (1 << CPOL) : 0) | (cpha ? (1 << CPHA) : 0)
+             | divider.sprBits;
+        SPSR = divider.doubleSpeed ? (1 << SPI2X) : 0;
+#elif defined(__AVR_ATtiny85__)
+        PRR &= ~(1 << PRUSI);
+        if (cpol) USCK::setHigh();
+        else      USCK::setLow();
+        USCK::setOutput();
+        DO::setOutput();
+        DI::setInput();
+        USICR = (1 << USIWM0) | (1 << USICS1) | ((cpol != cpha) ? (1 << USICS0) : 0);
+#endif
+        ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+            active = false;
+            pending.discard(pending.count());
+        }
+    }
+
+    static void end() {
+        flush();
+#if defined(__AVR_ATmega328P__)
+        SPCR = 0;
+#elif defined(__AVR_ATtiny85__)
+        USICR = 0;
+#endif
+    }
+
+    static inline bool busy() { return active; }
+
+    static inline void flush() {
+        while (active) { }
+    }
+
+    // one byte, in and out; the queue has to be empty (see transfer())
+    static inline uint8_t exchange(uint8_t data) {
+#if defined(__AVR_ATmega328P__)
+        SPDR = data;
+        while (!(SPSR & (1 << SPIF))) { }
+        return SPDR;
+#elif defined(__AVR_ATtiny85__)
+        if constexpr (order == BitOrder::LSB_FIRST) data = reverseBits(data);
+        USIDR = data;
+        USISR = (1 << USIOIF);      // counter back to 0, 16 edges to go
+        do {
+            USICR = strobe;
+            if constexpr (delay != 0) _delay_loop_1(static_cast<uint8_t>(delay));
+        } while (!(USISR & (1 << USIOIF)));
+        data = USIDR;
+        if constexpr (order == BitOrder::LSB_FIRST) data = reverseBits(data);
+        return data;
+#endif
+    }
+
+    // blocking; waits for queued transfers to finish first
+    static uint8_t transfer(uint8_t data) {
+        flush();
+        return exchange(data);
+    }
+
+    static void transfer(const uint8_t* tx, uint8_t* rx, uint16_t length) {
+        flush();
+        for (uint16_t i = 0; i < length; ++i) {
+            uint8_t data = exchange(tx ? tx[i] : 0xFF);
+            if (rx) rx[i] = data;
+        }
+    }
+
+    static void run(const Transfer& transfer) {
+        if (transfer.select) transfer.select();
+        Bus::transfer(transfer.tx, transfer.rx, transfer.length);
+        if (transfer.deselect) transfer.deselect();
+        if (transfer.done) transfer.done();
+    }
+
+#if defined(__AVR_ATmega328P__)
+    // the next queued transfer, if there is one
+    static void startNext() {
+        while (pending.pop(current)) {
+            if (current.select) current.select();
+            if (current.length) {
+                index = 0;
+                SPDR  = current.tx ? current.tx[0] : 0xFF;
+                return;
+            }
+            if (current.deselect) current.deselect();
+            if (current.done) current.done();
+        }
+        SPCR  &= ~(1 << SPIE);
+        active = false;
+    }
+
+    // call this (and only this) from ISR(SPI_STC_vect)
+    static inline void onTransferComplete() {
+        uint8_t data = SPDR;
+        if (current.rx) current.rx[index] = data;
+        if (++index < current.length) {
+            SPDR = current.tx ? current.tx[index] : 0xFF;
+            return;
+        }
+        if (current.deselect) current.deselect();
+        if (current.done) current.done();
+        startNext();
+    }
+#endif
+
+    // false if the queue's full
+    static bool queue(const Transfer& transfer) {
+#if defined(__AVR_ATmega328P__)
+        // callbacks queue from the ISR too, so both sides push with
+        // interrupts off
+        bool queued;
+        ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+            queued = pending.push(transfer);
+            if (queued && !active) {
+                active = true;
+                // SPIF is still set from the last blocking transfer;
+                // reading SPSR then writing SPDR clears it
+                (void) SPSR;
+                SPCR |= (1 << SPIE);
+                startNext();
+            }
+        }
+        return queued;
+#elif defined(__AVR_ATtiny85__)
+        run(transfer);
+        return true;
+#endif
+    }
+};
+
+/**
+ * A device on `Bus`, selected with its chip select pin
+ */
+template<typename Bus, uint8_t csPin, bool activeLow=true>
+struct Device {
+
+    using CS = HAL::GPIO::GPIO<csPin>;
+
+    static inline void select()   { if (activeLow) CS::setLow();  else CS::setHigh(); }
+    static inline void deselect() { if (activeLow) CS::setHigh(); else CS::setLow();  }
+
+    static void begin() {
+        deselect();
+        CS::setOutput();
+    }
+
+    static uint8_t transfer(uint8_t data) {
+        Bus::flush();
+        select();
+        data = Bus::exchange(data);
+        deselect();
+        return data;
+    }
+
+    static void transfer(const uint8_t* tx, uint8_t* rx, uint16_t length) {
+        Bus::flush();
+        select();
+        Bus::transfer(tx, rx, length);
+        deselect();
+    }
+
+    static inline void write(const uint8_t* tx, uint16_t length) { transfer(tx, nullptr, length); }
+    static inline void read(uint8_t* rx, uint16_t length)        { transfer(nullptr, rx, length); }
+
+    static bool queue(const uint8_t* tx, uint8_t* rx, uint16_t length,
+                      Callback done=nullptr, bool release=true) {
+        return Bus::queue({ tx, rx, length, select, release ? deselect : nullptr, done });
+    }
+};
+
+#if defined(__AVR_ATmega328P__)
+#define HAL_SPI_ISR(Bus)                      \
+    ISR(SPI_STC_vect) {                       \
+        Bus::onTransferComplete();            \
+    }
+#elif defined(__AVR_ATtiny85__)
+// nothing to do: the USI transfers are all blocking
+#define HAL_SPI_ISR(Bus)
+#endif
+
+
+}
+}
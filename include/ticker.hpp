@@ -10,10 +10,52 @@
 namespace HAL {
 namespace Ticker {
 
+/**
+ * A millisecond clock on Timer0 (see src/ticker.cpp)
+ *
+ * By default the compare match fires every millisecond. Build with
+ * HAL_TICKER_TICKLESS defined (for ticker.cpp _and_ everything that
+ * includes this) and it only fires when something is due: code that
+ * needs to run at a certain time (a debounce window closing, a long
+ * press) registers it with `requestWakeAt`, and `getNumTicks` works the
+ * current time out from the counter.
+ *
+ * `getTimestamp`/`getMicros` add TCNT0's progress through the current
+ * millisecond (4 us resolution at 16 MHz; 64 us when tickless) for timing
+ * things like encoder steps and pulse widths.
+ *
+ * `setTickHook` only exists with HAL_TICKER_TICK_HOOK defined (the same
+ * way as HAL_TICKER_TICKLESS): calling a function pointer from the ISR
+ * makes avr-gcc save every call-clobbered register on every tick, so
+ * without it the ISR stays a bare increment.
+ */
+
+// one consistent snapshot: milliseconds plus 0-999 microseconds past it
+struct Timestamp {
+    uint32_t ms;
+    uint16_t us;
+};
+
 void setupMSTimer();
 uint32_t getNumTicks();
+Timestamp getTimestamp();
+uint32_t getMicros();     // wraps every ~71.6 minutes
 void pause();
 void resume(uint16_t);
+void advance(uint32_t ms); // account for time Timer0 didn't see
+
+#if defined(HAL_TICKER_TICK_HOOK)
+// run from the compare match ISR (every millisecond, or at every deadline
+// when tickless); keep it short
+void setTickHook(Callback fnptr);
+#endif
+
+#if defined(HAL_TICKER_TICKLESS)
+void requestWakeAt(uint32_t when);
+#else
+// ticking every millisecond anyway
+inline void requestWakeAt(uint32_t) { }
+#endif
 
 }
 }
@@ -1,8 +1,10 @@
 #pragma once
 
 #include "common.hpp"
+#include "utils/RingBuffer.hpp"
+#include "utils/Format.hpp"
 
-#include <stdio.h>
+#include <util/atomic.h>
 #include <avr/io.h>
 #include <avr/sleep.h>
 #include <avr/interrupt.h>
@@ -52,15 +54,314 @@ inline void println(const char* str) {
     printByte('\n');
 }
 
-//  TODO  does it contain the null-terminator?
-//  TODO  take the format string and number templated
-//  TODO  should this even _B_ here?
+/**
+ * The blocking functions above, as a sink for HAL::Utils::Format
+ *
+ *      HAL::Utils::Format::hex<HAL::UART::BlockingTx>(PINB, 2);
+ */
+struct BlockingTx {
+    static inline void printByte(uint8_t data)  { HAL::UART::printByte(data); }
+    static inline void print(const char* str)   { HAL::UART::print(str); }
+    static inline void println(const char* str) { HAL::UART::println(str); }
+};
+
 inline void print(uint32_t n) {
-    char buf[20];
-    snprintf(buf, 20, "%lu", n);
-    println(buf);
+    HAL::Utils::Format::dec<BlockingTx>(n);
+}
+
+inline void println(uint32_t n) {
+    print(n);
+    printByte('\n');
 }
 
+/**
+ * Interrupt-driven, non-blocking transmit
+ *
+ * Bytes are queued in a ring buffer and drained by the USART Data
+ * Register Empty interrupt, so printing only costs the time it takes to
+ * copy into the buffer. Pick what happens when the buffer is full with
+ * `OverflowPolicy`:
+ *
+ *   - BLOCK     wait for the ISR to make room (the default)
+ *   - DROP      throw away the new byte
+ *   - OVERWRITE throw away the oldest queued byte
+ *
+ *      using Tx = HAL::UART::BufferedTx<64>;
+ *      HAL_UART_TX_ISR(Tx)
+ *
+ *      HAL::UART::init<9600>();
+ *      Tx::println("hello");
+ *
+ * `HAL_UART_TX_ISR` has to appear exactly once (in one translation unit)
+ *
+ * The blocking `printByte`/`print`/`println` above still work, but
+ * mixing them with a buffered transmitter will interleave output
+ *
+ * Before powering down, check `txBusy()` (or call `flush()`): sleeping
+ * with bytes still queued or in the shift register will garble them
+ */
+
+enum class OverflowPolicy : uint8_t { BLOCK, DROP, OVERWRITE };
+
+template<uint8_t bufferSize, OverflowPolicy policy=OverflowPolicy::BLOCK>
+struct BufferedTx {
+
+    static inline HAL::Utils::RingBuffer<uint8_t, bufferSize> buffer;
+    static inline volatile bool    active  { false };
+    static inline volatile uint8_t dropped { 0 };
+
+    // call this (and only this) from ISR(USART_UDRE_vect)
+    static inline void onDataRegisterEmpty() {
+        uint8_t data;
+        if (buffer.pop(data)) {
+            // writing a one clears TXC0; FE0, DOR0 and UPE0 must be
+            // written as zero, so keep only U2X0 and MPCM0
+            UCSR0A = (UCSR0A & ((1 << U2X0) | (1 << MPCM0))) | (1 << TXC0);
+            UDR0 = data;
+        } else {
+            UCSR0B &= ~(1 << UDRIE0);
+        }
+    }
+
+    static inline void printByte(uint8_t data) {
+        if (!buffer.push(data)) {
+            if constexpr (policy == OverflowPolicy::DROP) {
+                if (dropped < 0xFF) dropped = dropped + 1;
+                return;
+            } else if constexpr (policy == OverflowPolicy::OVERWRITE) {
+                ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+                    buffer.discard(1);
+                    buffer.push(data);
+                }
+                if (dropped < 0xFF) dropped = dropped + 1;
+            } else {
+                while (!buffer.push(data)) {
+                    // with interrupts off (called from an ISR, say) the
+                    // UDRE ISR can't run, so drain it by hand
+                    if (!(SREG & (1 << SREG_I)) && (UCSR0A & (1 << UDRE0)))
+                        onDataRegisterEmpty();
+                }
+            }
+        }
+        active = true;
+        UCSR0B |= (1 << UDRIE0);
+    }
+
+    static inline void print(const char* str) {
+        while (*str) {
+            printByte(*str++);
+        }
+    }
+
+    static inline void println(const char* str) {
+        print(str);
+        printByte('\n');
+    }
+
+    // true while anything is queued or still being shifted out
+    static inline bool txBusy() {
+        if (!active) return false;
+        if (!buffer.empty() || (UCSR0B & (1 << UDRIE0))) return true;
+        if (UCSR0A & (1 << TXC0)) {
+            active = false;
+            return false;
+        }
+        return true;
+    }
+
+    // wait until the last queued byte has left the shift register
+    static inline void flush() {
+        while (txBusy()) {
+            if (!(SREG & (1 << SREG_I)) && (UCSR0A & (1 << UDRE0)))
+                onDataRegisterEmpty();
+        }
+    }
+
+    // number of bytes lost to DROP/OVERWRITE (saturates at 255)
+    static inline uint8_t droppedCount() { return dropped; }
+    static inline void    clearDroppedCount() { dropped = 0; }
+};
+
+#define HAL_UART_TX_ISR(Tx)                   \
+    ISR(USART_UDRE_vect) {                    \
+        Tx::onDataRegisterEmpty();            \
+    }
+
+
+/**
+ * Interrupt-driven receive
+ *
+ * The USART Receive Complete interrupt moves every byte into a ring
+ * buffer as soon as it arrives, so nothing is lost while the main loop
+ * is busy elsewhere.
+ *
+ *      using Rx = HAL::UART::BufferedRx<64>;
+ *      HAL_UART_RX_ISR(Rx)
+ *
+ *      HAL::UART::init<9600>();
+ *      Rx::enable();
+ *
+ * Complete lines (or frames, with some other `delimiter`) are handed
+ * back as a `Span` pointing right into the ring buffer, so there is no
+ * need for a second line buffer:
+ *
+ *      Rx::Span line;
+ *      if (Rx::peekLine(line)) {
+ *          if (line.equals("reset")) ...
+ *          Rx::releaseLine();
+ *      }
+ *
+ * The span stays valid until `releaseLine()`. Since the buffer wraps,
+ * a span is (at most) two runs of bytes; use `at(i)`/`length()` or walk
+ * `first`/`second` directly.
+ *
+ * If the buffer fills up without a delimiter in it, `peekLine` hands
+ * back the whole buffer as a (truncated) line so it can be released
+ * instead of wedging the receiver.
+ *
+ * Errors are counted (saturating at 255):
+ *   - frameErrors     stop bit wasn't there (FE0; byte discarded)
+ *   - dataOverruns    hardware overran because the ISR was late (DOR0)
+ *   - bufferOverflows ring buffer was full (byte discarded)
+ */
+
+template<uint8_t bufferSize, uint8_t delimiter='\n'>
+struct BufferedRx {
+
+    struct Span {
+        const uint8_t* first;
+        uint8_t        firstLength;
+        const uint8_t* second;
+        uint8_t        secondLength;
+
+        uint8_t length() const { return firstLength + secondLength; }
+
+        uint8_t at(uint8_t i) const {
+            return (i < firstLength) ? first[i] : second[i - firstLength];
+        }
+
+        bool equals(const char* str) const {
+            uint8_t n = length();
+            for (uint8_t i = 0; i < n; ++i) {
+                if (static_cast<uint8_t>(str[i]) != at(i) || !str[i])
+                    return false;
+            }
+            return str[n] == '\0';
+        }
+
+        bool startsWith(const char* str) const {
+            uint8_t n = length();
+            for (uint8_t i = 0; str[i]; ++i) {
+                if (i >= n || static_cast<uint8_t>(str[i]) != at(i))
+                    return false;
+            }
+            return true;
+        }
+    };
+
+    static inline HAL::Utils::RingBuffer<uint8_t, bufferSize> buffer;
+
+    // ISR-written/main-read pair; the difference is the number of
+    // complete lines waiting
+    static inline volatile uint8_t delimitersReceived { 0 };
+    static inline volatile uint8_t delimitersReleased { 0 };
+
+    static inline volatile uint8_t frameErrors     { 0 };
+    static inline volatile uint8_t dataOverruns    { 0 };
+    static inline volatile uint8_t bufferOverflows { 0 };
+
+    // how many bytes (including the delimiter) the peeked line occupies
+    static inline uint8_t peekedLength { 0 };
+    static inline bool    peekedHasDelimiter { false };
+
+    static inline void enable()  { UCSR0B |=  (1 << RXCIE0); }
+    static inline void disable() { UCSR0B &= ~(1 << RXCIE0); }
+
+    // call this (and only this) from ISR(USART_RX_vect)
+    static inline void onReceiveComplete() {
+        // status has to be read before UDR0
+        uint8_t status = UCSR0A;
+        uint8_t data   = UDR0;
+
+        if (status & (1 << DOR0)) {
+            if (dataOverruns < 0xFF) dataOverruns = dataOverruns + 1;
+        }
+        if (status & (1 << FE0)) {
+            if (frameErrors < 0xFF) frameErrors = frameErrors + 1;
+            return;
+        }
+        if (!buffer.push(data)) {
+            if (bufferOverflows < 0xFF) bufferOverflows = bufferOverflows + 1;
+            return;
+        }
+        if (data == delimiter) {
+            delimitersReceived = delimitersReceived + 1;
+        }
+    }
+
+    static inline uint8_t available() { return buffer.count(); }
+
+    // raw byte-at-a-time access (don't mix with a peeked line)
+    static inline bool readByte(uint8_t& data) {
+        if (!buffer.pop(data)) return false;
+        if (data == delimiter) {
+            delimitersReleased = delimitersReleased + 1;
+        }
+        return true;
+    }
+
+    static inline bool hasLine() {
+        return delimitersReceived != delimitersReleased || buffer.full();
+    }
+
+    // `line` excludes the delimiter
+    static inline bool peekLine(Span& line) {
+        if (delimitersReceived != delimitersReleased) {
+            int16_t pos = buffer.find(delimiter);
+            peekedLength       = static_cast<uint8_t>(pos) + 1;
+            peekedHasDelimiter = true;
+            buffer.peekRuns(static_cast<uint8_t>(pos),
+                            line.first,  line.firstLength,
+                            line.second, line.secondLength);
+            return true;
+        }
+        if (buffer.full()) {
+            peekedLength       = buffer.capacity();
+            peekedHasDelimiter = false;
+            buffer.peekRuns(peekedLength,
+                            line.first,  line.firstLength,
+                            line.second, line.secondLength);
+            return true;
+        }
+        return false;
+    }
+
+    // drop the line returned by the last successful `peekLine`
+    static inline void releaseLine() {
+        if (!peekedLength) return;
+        buffer.discard(peekedLength);
+        if (peekedHasDelimiter) {
+            delimitersReleased = delimitersReleased + 1;
+        }
+        peekedLength = 0;
+    }
+
+    static inline uint8_t frameErrorCount()     { return frameErrors; }
+    static inline uint8_t dataOverrunCount()    { return dataOverruns; }
+    static inline uint8_t bufferOverflowCount() { return bufferOverflows; }
+
+    static inline void clearErrorCounts() {
+        frameErrors     = 0;
+        dataOverruns    = 0;
+        bufferOverflows = 0;
+    }
+};
+
+#define HAL_UART_RX_ISR(Rx)                   \
+    ISR(USART_RX_vect) {                      \
+        Rx::onReceiveComplete();              \
+    }
+
 #endif
 
 }
@@ -0,0 +1,201 @@
+#pragma once
+
+#include "common.hpp"
+
+#include <stdint.h>
+#include <avr/pgmspace.h>
+
+/**
+ * printf-free number formatting
+ *
+ * Everything here writes through a "sink": any type with a static
+ * `printByte(uint8_t)`, like `HAL::UART::BlockingTx` or a
+ * `HAL::UART::BufferedTx<...>`
+ *
+ *      using namespace HAL::Utils;
+ *      Format::dec<Tx>(-42);               // "-42"
+ *      Format::dec<Tx>(7u, 3, '0');        // "007"
+ *      Format::hex<Tx>(uint8_t{0xA}, 2);   // "0A"
+ *      Format::bin<Tx>(uint8_t{5}, 8);     // "00000101"
+ *      Format::fixed<Tx, 2>(-1234);        // "-12.34"  (value / 10^2)
+ *      Format::fixedQ<Tx, 8, 3>(0x0180);   // "1.500"   (Q8.8)
+ *
+ * `width` is the minimum number of characters (sign included), padded
+ * on the left with `pad`. With '0' padding the sign goes in front of
+ * the zeros.
+ *
+ * Decimal conversion doesn't divide: each digit is found by repeatedly
+ * subtracting the matching power of ten (at most 9 times), which is a lot
+ * cheaper on AVR than the software division that `%`/`/` (and so
+ * vfprintf) pull in. The powers of ten live in flash, and the table used
+ * is only as wide as the argument, so 8- and 16-bit values never touch
+ * 32-bit arithmetic.
+ */
+
+namespace HAL {
+namespace Utils {
+namespace Format {
+
+template<typename T> struct NumTraits;
+
+template<> struct NumTraits<uint8_t>  { using U = uint8_t;  static constexpr bool isSigned = false; };
+template<> struct NumTraits<int8_t>   { using U = uint8_t;  static constexpr bool isSigned = true;  };
+template<> struct NumTraits<uint16_t> { using U = uint16_t; static constexpr bool isSigned = false; };
+template<> struct NumTraits<int16_t>  { using U = uint16_t; static constexpr bool isSigned = true;  };
+template<> struct NumTraits<uint32_t> { using U = uint32_t; static constexpr bool isSigned = false; };
+template<> struct NumTraits<int32_t>  { using U = uint32_t; static constexpr bool isSigned = true;  };
+
+inline const uint8_t  pow10u8[]  PROGMEM = { 100, 10 };
+inline const uint16_t pow10u16[] PROGMEM = { 10000, 1000, 100, 10 };
+inline const uint32_t pow10u32[] PROGMEM = { 1000000000UL, 100000000UL, 10000000UL,
+                                             1000000UL, 100000UL, 10000UL,
+                                             1000UL, 100UL, 10UL };
+
+inline uint8_t  readPow10(const uint8_t*  p) { return pgm_read_byte(p);  }
+inline uint16_t readPow10(const uint16_t* p) { return pgm_read_word(p);  }
+inline uint32_t readPow10(const uint32_t* p) { return pgm_read_dword(p); }
+
+template<typename U> struct Pow10;
+template<> struct Pow10<uint8_t>  { static constexpr const uint8_t*  table() { return pow10u8;  } static constexpr uint8_t count = 2; };
+template<> struct Pow10<uint16_t> { static constexpr const uint16_t* table() { return pow10u16; } static constexpr uint8_t count = 4; };
+template<> struct Pow10<uint32_t> { static constexpr const uint32_t* table() { return pow10u32; } static constexpr uint8_t count = 9; };
+
+// writes the decimal digits of `n` (no terminator) and returns how many
+template<typename U>
+inline uint8_t toDecimal(U n, char* buf) {
+    uint8_t len     { 0 };
+    bool    started { false };
+    for (uint8_t i = 0; i < Pow10<U>::count; ++i) {
+        U power = readPow10(Pow10<U>::table() + i);
+        char digit { '0' };
+        while (n >= power) {
+            n -= power;
+            ++digit;
+        }
+        if (started || digit != '0') {
+            buf[len++] = digit;
+            started = true;
+        }
+    }
+    buf[len++] = static_cast<char>('0' + n);
+    return len;
+}
+
+template<typename Sink>
+inline void repeat(char c, int8_t n) {
+    while (n-- > 0) Sink::printByte(c);
+}
+
+// sign and (possibly '.'-split) digits, padded out to `width`
+template<typename Sink>
+inline void emit(bool negative, const char* digits, uint8_t len,
+                 uint8_t dotAfter, uint8_t width, char pad) {
+    int8_t padding = static_cast<int8_t>(width) - len - negative - (dotAfter < len);
+    if (pad == '0') {
+        if (negative) Sink::printByte('-');
+        repeat<Sink>('0', padding);
+    } else {
+        repeat<Sink>(pad, padding);
+        if (negative) Sink::printByte('-');
+    }
+    for (uint8_t i = 0; i < len; ++i) {
+        if (i == dotAfter) Sink::printByte('.');
+        Sink::printByte(digits[i]);
+    }
+}
+
+template<typename T>
+inline typename NumTraits<T>::U magnitude(T value, bool& negative) {
+    using U = typename NumTraits<T>::U;
+    negative = NumTraits<T>::isSigned && value < 0;
+    // negate in unsigned so the most negative value works too
+    return negative ? static_cast<U>(0U - static_cast<U>(value))
+                    : static_cast<U>(value);
+}
+
+template<typename Sink, typename T>
+inline void dec(T value, uint8_t width=0, char pad=' ') {
+    bool negative;
+    auto n = magnitude(value, negative);
+    char    buf[10];
+    uint8_t len = toDecimal(n, buf);
+    emit<Sink>(negative, buf, len, 0xFF, width, pad);
+}
+
+// `width` is the minimum number of hex digits
+template<typename Sink, typename T>
+inline void hex(T value, uint8_t width=0, char pad='0') {
+    using U = typename NumTraits<T>::U;
+    U n = static_cast<U>(value);
+    constexpr uint8_t maxDigits = sizeof(U) * 2;
+    char    buf[maxDigits];
+    uint8_t len { 0 };
+    for (int8_t shift = (maxDigits - 1) * 4; shift >= 0; shift -= 4) {
+        uint8_t nibble = (n >> shift) & 0x0F;
+        if (len || nibble || shift == 0)
+            buf[len++] = static_cast<char>(nibble < 10 ? '0' + nibble : 'A' - 10 + nibble);
+    }
+    emit<Sink>(false, buf, len, 0xFF, width, pad);
+}
+
+// `width` is the minimum number of binary digits
+template<typename Sink, typename T>
+inline void bin(T value, uint8_t width=0, char pad='0') {
+    using U = typename NumTraits<T>::U;
+    U n = static_cast<U>(value);
+    constexpr uint8_t maxDigits = sizeof(U) * 8;
+    bool started { false };
+    int8_t padding = static_cast<int8_t>(width);
+    for (int8_t bit = maxDigits - 1; bit >= 0; --bit) {
+        if (!((n >> bit) & 1) && !started && bit > 0) continue;
+        if (!started) {
+            repeat<Sink>(pad, padding - bit - 1);
+            started = true;
+        }
+        Sink::printByte(((n >> bit) & 1) ? '1' : '0');
+    }
+}
+
+// `value` is a decimal fixed-point number scaled by 10^decimals
+template<typename Sink, uint8_t decimals, typename T>
+inline void fixed(T value, uint8_t width=0, char pad=' ') {
+    static_assert(decimals > 0 && decimals < 10, "1 to 9 decimals");
+    bool negative;
+    auto n = magnitude(value, negative);
+    char    digits[10];
+    char    buf[11];
+    uint8_t len = toDecimal(n, digits);
+    // make sure there's at least one digit in front of the '.'
+    uint8_t leading = (len <= decimals) ? (decimals + 1 - len) : 0;
+    for (uint8_t i = 0; i < leading; ++i) buf[i] = '0';
+    for (uint8_t i = 0; i < len; ++i)     buf[leading + i] = digits[i];
+    len += leading;
+    emit<Sink>(negative, buf, len, len - decimals, width, pad);
+}
+
+// `value` is a binary fixed-point number with `fracBits` fraction bits
+// (e.g. Q8.8); prints `fracDigits` digits after the '.' (truncated)
+template<typename Sink, uint8_t fracBits, uint8_t fracDigits, typename T>
+inline void fixedQ(T value, uint8_t width=0, char pad=' ') {
+    using U = typename NumTraits<T>::U;
+    static_assert(fracBits > 0 && fracBits < sizeof(U) * 8 && fracBits <= 27,
+            "fracBits must fit in the type and leave room to scale by 10");
+    static_assert(fracDigits > 0 && fracDigits <= 9, "1 to 9 fraction digits");
+    bool negative;
+    U n = magnitude(value, negative);
+    char    buf[10 + fracDigits];
+    uint8_t len = toDecimal(static_cast<U>(n >> fracBits), buf);
+    uint8_t dot = len;
+    uint32_t frac = n & ((static_cast<uint32_t>(1) << fracBits) - 1);
+    for (uint8_t i = 0; i < fracDigits; ++i) {
+        frac = (frac << 3) + (frac << 1);   // * 10
+        buf[len++] = static_cast<char>('0' + (frac >> fracBits));
+        frac &= (static_cast<uint32_t>(1) << fracBits) - 1;
+    }
+    emit<Sink>(negative, buf, len, dot, width, pad);
+}
+
+
+}
+}
+}
@@ -3,8 +3,10 @@
 #include "common.hpp"
 
 #include <stdint.h>
+#include <util/atomic.h>
 #include "gpio.hpp"
 #include "ticker.hpp"
+#include "RingBuffer.hpp"
 
     //  TODO  BEEF UP DOCUMENTATION
     //  TODO  mention .enable()
@@ -39,6 +41,8 @@
  * where `previousPINB` is `volatile uint8_t previousPINB { 0xFF  };`
  * or whatever.
  *
+ * (HAL::Utils::PcintDispatcher can write these ISRs for you)
+ *
  * This notifies the Debouncer that a change happened in the PORT. It
  * supplies the number of ticks in Timer0 (see Ticker.hpp) and a mask
  * of which pins changed.
@@ -96,6 +100,60 @@
  *
  * Beware: an unprocessed interrupt will prevent the MCU from sleeping
  *
+ * EVENT QUEUE MODE
+ *
+ * Normally only the first ("prime") interrupt of a burst is recorded and
+ * everything until `processAnyInterrupts()` runs is ignored. That's fine
+ * as long as the main loop comes around faster than the input changes,
+ * but if it's slow, a whole tap (press _and_ release) can come and go
+ * between two calls and vanish.
+ *
+ * Give the last template parameter a (power of two) queue size
+ *
+            HAL::Utils::IntTransitionDebouncer<3, 30, HIGH, true, 8> sw;
+ *
+ * and the ISR side instead pushes every edge (timestamp and pin level)
+ * into a lock-free ring buffer. `processAnyInterrupts()` replays them in
+ * order: the first queued edge opens a debounce window, the level at the
+ * end of the window (the level of the last edge inside it, or the live
+ * pin if the queue ran dry) is the candidate stable state, and the next
+ * edge after the window opens the next one. It returns one transition
+ * per call, so a backlog comes out over consecutive calls.
+ *
+ * If the queue fills up, new edges are dropped and counted
+ * (`droppedEvents()`, saturating at 255) so the queue can be sized from
+ * real traces. Since a window that ends the queue uses the live pin, a
+ * dropped edge can't leave the stable state wrong for good.
+ *
+ * SMALLER STATE
+ *
+ * Timestamps are only ever compared as `now - then` against the debounce
+ * window, so they don't have to be 32 bits wide. The `Stamp` template
+ * parameter picks the width
+ *
+            HAL::Utils::IntTransitionDebouncer<3, 30, HIGH, true, 0, uint8_t> sw;
+ *
+ * and the window has to fit in it (checked at compile time). An 8-bit
+ * stamp is good for windows up to 255 ticks, as long as
+ * `processAnyInterrupts()` gets called at least that often while an
+ * interrupt is pending (otherwise a wrapped stamp just delays the
+ * transition by another lap). It also halves the size of a queued event
+ * and makes the ISR-side write a single byte.
+ *
+ * The stable state and the "interrupt pending" flag share one byte; the
+ * top six bits of it are left for the owner (`getOwnerFlag`,
+ * `setOwnerFlag`). Owners that handle the transitions themselves (like
+ * Button and RotaryEncoder) pass `callbacksP=false` and drop the two
+ * callback pointers. With both, a plain debouncer is 2 bytes of RAM
+ * instead of 10.
+ *
+ * HAL::Sleep::TimedSleep (see sleep.hpp) does the pause/resume bookkeeping
+ * for you, using the watchdog to measure how long the MCU slept
+ *
+        if (!sw.pendingDebounceTimeout()) {
+            HAL::Sleep::TimedSleep::sleepFor(8000);
+        }
+ *
  */
 
 //  TODO  member function to cancel and pending interrupt notices
@@ -106,91 +164,219 @@ enum class Transition : uint8_t { RISING, FALLING, NONE };
 
 namespace Utils {
 
-template<uint8_t physicalPin,
+template<typename Stamp>
+struct PinEvent {
+    Stamp time;
+    bool  level;
+};
+
+// what the ISR side records: the whole queue of edges, or just the time
+// of the prime interrupt
+template<uint8_t eventQueueSize, typename Stamp>
+struct InterruptRecord {
+    RingBuffer<PinEvent<Stamp>, eventQueueSize> events;
+    volatile uint8_t                            dropped { 0 };
+};
+
+template<typename Stamp>
+struct InterruptRecord<0, Stamp> {
+    volatile Stamp lastUnprocessedPrimeInterrupt { 0 };
+};
+
+template<bool callbacksP>
+struct TransitionCallbacks {
+    Callback onFalling { nullptr };
+    Callback onRising  { nullptr };
+};
+
+template<>
+struct TransitionCallbacks<false> { };
+
+template<uint8_t  physicalPin,
          uint32_t debounceWaitTime,
-         bool initialState,
-         bool usePullupP>
-class IntTransitionDebouncer {
+         bool     initialState,
+         bool     usePullupP,
+         uint8_t  eventQueueSize=0,
+         typename Stamp=uint32_t,
+         bool     callbacksP=true>
+class IntTransitionDebouncer : private InterruptRecord<eventQueueSize, Stamp>,
+                               private TransitionCallbacks<callbacksP> {
+
+    using Pin = HAL::GPIO::GPIO<physicalPin>;
+
+    static constexpr bool queuedP { eventQueueSize > 0 };
 
-    using Callback = void (*)();
+    static_assert(debounceWaitTime > 0 &&
+                  debounceWaitTime < (1ULL << (8 * sizeof(Stamp))),
+            "debounceWaitTime doesn't fit in the timestamp type");
 
-    HAL::GPIO::GPIO<physicalPin> gpio;
-    volatile uint32_t            lastUnprocessedPrimeInterrupt;
-    bool                         stableState;
-    Callback                     onFalling;
-    Callback                     onRising;
+    static constexpr uint8_t STABLE_STATE { 1 << 0 };
+    static constexpr uint8_t PENDING      { 1 << 1 };  // set by the ISR
+
+    // the ISR only ever sets PENDING (and only when it's clear), so the
+    // main loop's read-modify-writes are done with interrupts off
+    volatile uint8_t flags;
+
+    void updateFlags(uint8_t clear, uint8_t set) {
+        ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+            flags = (flags & ~clear) | set;
+        }
+    }
 
   public:
 
-    IntTransitionDebouncer() 
-        : gpio                          { },
-          lastUnprocessedPrimeInterrupt { 0 },
-          stableState                   { initialState },
-          onFalling                     { nullptr },
-          onRising                      { nullptr } {
+    // bits 2-7 of `flags` are free for whatever owns this debouncer
+    // (Button keeps its own state there instead of in more bools)
+    static constexpr uint8_t firstOwnerFlag { 2 };
+
+    IntTransitionDebouncer()
+        : flags { initialState ? STABLE_STATE : uint8_t{ 0 } } {
     }
 
     void begin() {
         if constexpr (usePullupP)
-            gpio.setInputPullup();
+            Pin::setInputPullup();
         else
-            gpio.setInput();
-        gpio.enablePCINT();
+            Pin::setInput();
+        Pin::enablePCINT();
+    }
+
+    // the bit this debouncer wants to hear about in PCINT group
+    // `pcicrBit` (see PcintDispatcher)
+    static constexpr uint8_t pcintMask(uint8_t pcicrBit) {
+        return (Pin::info.pcicrBit == pcicrBit) ? Pin::mask : 0;
     }
 
     void notifyInterruptOccurred(uint32_t now, uint8_t changed) {
-        if (changed & gpio.mask) {
-            if (!lastUnprocessedPrimeInterrupt) {
-                lastUnprocessedPrimeInterrupt = now;
+        if (changed & Pin::mask) {
+            if constexpr (queuedP) {
+                bool wasEmpty { this->events.empty() };
+                if (this->events.push({ static_cast<Stamp>(now), Pin::read() })) {
+                    if (wasEmpty)
+                        HAL::Ticker::requestWakeAt(now + debounceWaitTime);
+                } else if (this->dropped < 0xFF) {
+                    this->dropped = this->dropped + 1;
+                }
+            } else {
+                if (!(flags & PENDING)) {
+                    this->lastUnprocessedPrimeInterrupt = static_cast<Stamp>(now);
+                    flags = flags | PENDING;
+                    HAL::Ticker::requestWakeAt(now + debounceWaitTime);
+                }
             }
         }
     }
 
-    void setOnFalling(Callback fnptr) { onFalling = fnptr; }
-    void setOnRising(Callback fnptr)  {  onRising = fnptr; }
+    void setOnFalling(Callback fnptr) {
+        static_assert(callbacksP, "this debouncer was built without callbacks");
+        this->onFalling = fnptr;
+    }
+
+    void setOnRising(Callback fnptr) {
+        static_assert(callbacksP, "this debouncer was built without callbacks");
+        this->onRising = fnptr;
+    }
 
     Transition processAnyInterrupts() {
-        Transition transition                    { Transition::NONE };
-        uint32_t   snapshotOfPrimeInterreuptTime { 0 };
+        if constexpr (queuedP)
+            return processQueuedInterrupts();
+        else
+            return processPrimeInterrupt();
+    }
 
-        READ_VOLATILE_U32(lastUnprocessedPrimeInterrupt, snapshotOfPrimeInterreuptTime);
+    bool getStableState() {
+        return flags & STABLE_STATE;
+    }
 
-        if (snapshotOfPrimeInterreuptTime > 0) {
-            uint32_t now = HAL::Ticker::getNumTicks();
-            if (((now - snapshotOfPrimeInterreuptTime)) >= debounceWaitTime) {
-                bool nowState { gpio.read() };
-
-                if (nowState != stableState) {
-                    Transition tentative = nowState
-                        ? Transition::RISING
-                        : Transition::FALLING;
-
-                    bool wonTheRaceP { false };
-                    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
-                        if (lastUnprocessedPrimeInterrupt == snapshotOfPrimeInterreuptTime) {
-                            lastUnprocessedPrimeInterrupt = 0;
-                            stableState = nowState;
-                            transition = tentative;
-                            wonTheRaceP = true;
-                        }
-                    }
-
-                    if (wonTheRaceP) {
-                        if (transition == Transition::RISING  &&  onRising)  onRising();
-                        if (transition == Transition::FALLING && onFalling) onFalling();
-                    }
-                }
-            }
+    bool pendingDebounceTimeout() {
+        if constexpr (queuedP)
+            return !this->events.empty();
+        else
+            return flags & PENDING;
+    }
+
+    uint8_t droppedEvents() {
+        if constexpr (queuedP)
+            return this->dropped;
+        else
+            return 0;
+    }
+
+    bool getOwnerFlag(uint8_t bit) {
+        return flags & (1 << bit);
+    }
+
+    void setOwnerFlag(uint8_t bit, bool value) {
+        if (value) updateFlags(0, 1 << bit);
+        else       updateFlags(1 << bit, 0);
+    }
+
+  private:
+
+    // wraparound-safe as long as we get looked at at least once every
+    // 2^(8*sizeof(Stamp)) ticks
+    static Stamp elapsedSince(uint32_t now, Stamp then) {
+        return static_cast<Stamp>(static_cast<Stamp>(now) - then);
+    }
+
+    Transition settle(bool nowState, uint8_t clear) {
+        Transition transition { Transition::NONE };
+        uint8_t    set        { 0 };
+        if (nowState != getStableState()) {
+            clear     |= STABLE_STATE;
+            set        = nowState ? STABLE_STATE : 0;
+            transition = nowState ? Transition::RISING : Transition::FALLING;
+        }
+        if (clear || set) updateFlags(clear, set);
+
+        if constexpr (callbacksP) {
+            if (transition == Transition::RISING  &&  this->onRising)  this->onRising();
+            if (transition == Transition::FALLING && this->onFalling) this->onFalling();
         }
         return transition;
     }
 
-    bool getStableState() {
-        return stableState;
+    Transition processPrimeInterrupt() {
+        if (!(flags & PENDING)) return Transition::NONE;
+
+        // the ISR leaves the stamp alone while PENDING is set, so this
+        // needs no ATOMIC_BLOCK, however wide it is
+        Stamp prime = this->lastUnprocessedPrimeInterrupt;
+        if (elapsedSince(HAL::Ticker::getNumTicks(), prime) < debounceWaitTime)
+            return Transition::NONE;
+
+        return settle(Pin::read(), PENDING);
     }
 
-    bool pendingDebounceTimeout() {
-        return lastUnprocessedPrimeInterrupt > 0;
+    Transition processQueuedInterrupts() {
+        uint32_t now { HAL::Ticker::getNumTicks() };
+
+        while (!this->events.empty()) {
+            Stamp primeTime = this->events.peek(0).time;
+            Stamp elapsed   = elapsedSince(now, primeTime);
+            if (elapsed < debounceWaitTime) {
+                HAL::Ticker::requestWakeAt(now + (debounceWaitTime - elapsed));
+                break;
+            }
+
+            // everything that happened inside this window
+            uint8_t queued   { this->events.count() };
+            uint8_t inWindow { 1 };
+            while (inWindow < queued &&
+                   static_cast<Stamp>(this->events.peek(inWindow).time - primeTime)
+                       < debounceWaitTime) {
+                ++inWindow;
+            }
+
+            bool settled = (inWindow == queued)
+                ? Pin::read()
+                : this->events.peek(inWindow - 1).level;
+            this->events.discard(inWindow);
+
+            Transition transition = settle(settled, 0);
+            if (transition != Transition::NONE) return transition;
+        }
+        return Transition::NONE;
     }
 
 };
@@ -198,4 +384,3 @@ class IntTransitionDebouncer {
 
 }
 }
-
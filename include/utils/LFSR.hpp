@@ -2,13 +2,38 @@
 
 #include "common.hpp"
 
+#include <stddef.h>
 #include <stdint.h>
 
 /**
  * An implementation of an 8-bit fibonacci linear feedback shift register
  * using a maximally long period (taps: 00011101)
  *
- * Calls out to hand-written assembly
+ * Calls out to hand-written assembly, which runs the eight shifts of a
+ * byte in one go with the state in a register. Repeats every 255 bytes;
+ * for a longer period, use Xorshift16 or Xorshift32 (also LFSRs, just
+ * not shifting one bit at a time). All of them are seeded with `init()`.
+ * A zero state would give nothing but zeros, so they never have one:
+ * before `init()` they start from a fixed default seed (0xA5, 0xACE1 and
+ * 2463534242), and `init(0)` means that default too.
+ *
+ * Cycles, not counting the call (4 on the 328P, 3 on the tiny85):
+ *
+ *      LFSR::nextByte()            34
+ *      LFSR::fill(buf, n)          31 a byte, plus 14
+ *      Xorshift16::next()          23              period 2^16 - 1
+ *      Xorshift32::next()          65              period 2^32 - 1
+ *
+ * `uniform(range)` returns a number from 0 to range - 1. Every state but
+ * zero comes up once per period, so the outputs are the numbers 1 to
+ * 2^bits - 1, each equally likely; it takes one off and throws away the
+ * top ones that don't make a whole multiple of `range`, so it's exactly
+ * unbiased. That takes two divisions (see bench/ for what they cost), so
+ * for a fixed power-of-two range, mask `next()` instead.
+ *
+        HAL::Utils::Random::Xorshift16::init(seed);
+        ...
+        uint8_t die = 1 + HAL::Utils::Random::Xorshift16::uniform(6);
  */
 
 namespace HAL {
@@ -18,6 +43,24 @@ namespace Random {
 struct LFSR {
     static void init(uint8_t seed);
     static uint8_t nextByte();
+    static void fill(uint8_t* buf, size_t n);
+    static uint8_t uniform(uint8_t range);
+};
+
+struct Xorshift16 {
+    static void init(uint16_t seed);
+    static uint16_t next();
+    static uint8_t nextByte() { return static_cast<uint8_t>(next()); }
+    static void fill(uint8_t* buf, size_t n);
+    static uint16_t uniform(uint16_t range);
+};
+
+struct Xorshift32 {
+    static void init(uint32_t seed);
+    static uint32_t next();
+    static uint8_t nextByte() { return static_cast<uint8_t>(next()); }
+    static void fill(uint8_t* buf, size_t n);
+    static uint32_t uniform(uint32_t range);
 };
 
 }
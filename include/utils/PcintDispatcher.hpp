@@ -0,0 +1,138 @@
+#pragma once
+
+#include "common.hpp"
+
+#include <stdint.h>
+#include "gpio.hpp"
+#include "ticker.hpp"
+
+/**
+ * Writes the pin change ISRs for you
+ *
+ * Instead of an `ISR(PCINTx_vect)` per port that keeps its own
+ * `previousPINx`, works out what changed, and notifies every device by
+ * hand, list the devices once
+ *
+        HAL::Devices::Button<14, 30, 1000, HIGH, true>         btn;
+        HAL::Devices::RotaryEncoder<23, 24, 5, HIGH, true>     enc;
+
+        using Pcint = HAL::Utils::PcintDispatcher<btn, enc>;
+        HAL_PCINT_DISPATCH(Pcint, 0)        // PB0
+        HAL_PCINT_DISPATCH(Pcint, 1)        // PC0, PC1
+
+        int main() {
+            btn.begin();
+            enc.begin();
+            Pcint::begin();
+            sei();
+            ...
+ *
+ * Any object with a static `pcintMask(pcicrBit)` (the pins it wants, per
+ * PCINT group, from `pinTable`) and `notifyInterruptOccurred(now,
+ * changed)` can be listed; the devices in this repo all qualify.
+ *
+ * Per group, the ISR reads the port once, takes one tick snapshot, and
+ * only calls the devices whose pins actually changed, each getting
+ * `changed` masked down to its own pins (so a device that spans two ports
+ * never mistakes a change on one for a change on the other). Everything
+ * about which device sits in which group is worked out at compile time.
+ *
+ * Write one HAL_PCINT_DISPATCH per PCINT group the devices use, and none
+ * for the others, so an unused group costs no vector and no ISR; naming a
+ * group none of the devices use (or one the MCU doesn't have) is a
+ * compile error. A used group with no HAL_PCINT_DISPATCH isn't caught,
+ * and its first pin change resets the chip through the default vector.
+ * A group none of the devices use gets no `previous` byte either.
+ *
+ * The devices must have static storage duration (globals), since they're
+ * template arguments.
+ */
+
+namespace HAL {
+namespace Utils {
+
+template<auto&... devices>
+struct PcintDispatcher {
+
+    // which PCICR (or GIMSK) bit a group index stands for, and its port
+#if defined(__AVR_ATtiny85__)
+    static constexpr uint8_t groups { 1 };
+    static constexpr uint8_t groupBit(uint8_t)             { return PCIE; }
+    static constexpr HAL::GPIO::Port groupPort(uint8_t)    { return HAL::GPIO::Port::B; }
+#elif defined(__AVR_ATmega328P__)
+    static constexpr uint8_t groups { 3 };
+    static constexpr uint8_t groupBit(uint8_t group) {
+        return group == 0 ? PCIE0 : group == 1 ? PCIE1 : PCIE2;
+    }
+    static constexpr HAL::GPIO::Port groupPort(uint8_t group) {
+        return group == 0 ? HAL::GPIO::Port::B
+             : group == 1 ? HAL::GPIO::Port::C
+             :              HAL::GPIO::Port::D;
+    }
+#endif
+
+    template<uint8_t group>
+    static constexpr uint8_t groupMask() {
+        return (0 | ... | devices.pcintMask(groupBit(group)));
+    }
+
+    template<uint8_t group>
+    static inline volatile uint8_t previous { 0 };
+
+    template<uint8_t group>
+    static inline uint8_t readGroup() {
+        return HAL::GPIO::PortRegisters<groupPort(group)>::pin();
+    }
+
+    template<uint8_t group, auto& device>
+    static inline void notifyIfChanged(uint32_t now, uint8_t changed) {
+        constexpr uint8_t mask = device.pcintMask(groupBit(group));
+        if constexpr (mask != 0) {
+            if (changed & mask) device.notifyInterruptOccurred(now, changed & mask);
+        }
+    }
+
+    // call from ISR(PCINTx_vect) for `group` (HAL_PCINT_DISPATCH does)
+    template<uint8_t group>
+    static inline void handle() {
+        if constexpr (groupMask<group>() != 0) {
+            uint8_t current = readGroup<group>();
+            uint8_t changed = (current ^ previous<group>) & groupMask<group>();
+            previous<group> = current;
+            if (!changed) return;
+            uint32_t now = HAL::Ticker::getNumTicks();
+            (notifyIfChanged<group, devices>(now, changed), ...);
+        }
+    }
+
+    // snapshot the ports so the first interrupt has something to
+    // compare against; call after the devices' begin()
+    static inline void begin() {
+        beginGroup<0>();
+#if defined(__AVR_ATmega328P__)
+        beginGroup<1>();
+        beginGroup<2>();
+#endif
+    }
+
+    template<uint8_t group>
+    static inline void beginGroup() {
+        if constexpr (groupMask<group>() != 0) {
+            previous<group> = readGroup<group>();
+        }
+    }
+};
+
+
+}
+}
+
+// ISR(PCINT<group>_vect) for one group; `group` is a literal 0, 1 or 2
+#define HAL_PCINT_DISPATCH(Dispatcher, group)                             \
+    ISR(PCINT##group##_vect) {                                            \
+        static_assert(group < Dispatcher::groups,                         \
+                      "this MCU has no PCINT" #group);                    \
+        static_assert(Dispatcher::template groupMask<group>() != 0,       \
+                      "none of the devices use PCINT" #group);            \
+        Dispatcher::template handle<group>();                             \
+    }
@@ -0,0 +1,148 @@
+#pragma once
+
+#include "common.hpp"
+
+#include <stdint.h>
+#include <util/atomic.h>
+#include "gpio.hpp"
+
+/**
+ * Debounces (up to) a whole port at once
+ *
+ * An IntTransitionDebouncer per switch means a 32-bit timestamp, a stable
+ * state, two callbacks and a `processAnyInterrupts()` per pin. For a
+ * panel of switches, this samples the port on a timer instead and
+ * debounces every pin in `mask` in parallel with a 2-bit "vertical
+ * counter": bit n of `count0` and bit n of `count1` make up pin n's
+ * counter, so one byte-wide logic operation updates all eight counters.
+ * A pin has to read differently from its debounced state for four
+ * consecutive samples before the state flips, and any sample that agrees
+ * with the debounced state resets its counter.
+ *
+        using Panel = HAL::Utils::PortDebouncer<HAL::GPIO::Port::D, 0b11111100>;
+
+        Panel::begin();
+        HAL::Ticker::setupMSTimer();
+        HAL::Ticker::setTickHook(Panel::onTick);
+        ...
+        uint8_t pressed = Panel::takePressed();
+        if (pressed & (1 << 2)) ...
+ *
+ * The tick hook needs HAL_TICKER_TICK_HOOK defined, for ticker.cpp and
+ * everything that includes ticker.hpp (it's off by default, to keep the
+ * ticker's ISR lean).
+ *
+ * With the default 5 ms sample period a change has to hold for 20 ms.
+ * `onTick` assumes it's called every millisecond (the default Ticker);
+ * with a tickless Ticker, call `sample()` from something periodic
+ * instead. For more than one port, call each one's `onTick` from your
+ * own tick hook.
+ *
+ * Edges are collected in the ISR until the main loop takes them, so a
+ * slow main loop sees every press (though not how many times a pin went
+ * down in between).
+ *
+ * All of the state is static: one PortDebouncer per Port/mask pair, six
+ * bytes of RAM for up to eight switches.
+ */
+
+namespace HAL {
+namespace Utils {
+
+template<HAL::GPIO::Port port,
+         uint8_t mask,
+         bool    passiveState=HIGH,
+         bool    usePullupP=true,
+         uint8_t samplePeriodMs=5>
+struct PortDebouncer {
+
+    static_assert(mask != 0, "PortDebouncer needs at least one pin");
+    static_assert(samplePeriodMs > 0, "samplePeriodMs must be at least 1");
+
+    using regs = HAL::GPIO::PortRegisters<port>;
+
+    static inline volatile uint8_t state   { 0 };
+    static inline volatile uint8_t count0  { 0xFF };
+    static inline volatile uint8_t count1  { 0xFF };
+    static inline volatile uint8_t rising  { 0 };
+    static inline volatile uint8_t falling { 0 };
+    static inline volatile uint8_t divider { 0 };
+
+    static inline void begin() {
+        regs::ddr() &= ~mask;
+        if constexpr (usePullupP)
+            regs::port() |= mask;
+        ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+            state   = regs::pin() & mask;
+            count0  = 0xFF;
+            count1  = 0xFF;
+            rising  = 0;
+            falling = 0;
+        }
+    }
+
+    // call from an ISR
+    static inline void sample() {
+        uint8_t s       = state;
+        uint8_t differs = (s ^ regs::pin()) & mask;
+        uint8_t c0      = ~(count0 & differs);
+        uint8_t c1      = c0 ^ (count1 & differs);
+        uint8_t flipped = differs & c0 & c1;
+        count0  = c0;
+        count1  = c1;
+        s      ^= flipped;
+        state   = s;
+        rising  = rising  | (flipped &  s);
+        falling = falling | (flipped & ~s);
+    }
+
+    // call from the Ticker's tick hook (every millisecond)
+    static inline void onTick() {
+        uint8_t d = divider + 1;
+        if (d >= samplePeriodMs) {
+            d = 0;
+            sample();
+        }
+        divider = d;
+    }
+
+    // debounced levels of the pins in `mask`
+    static inline uint8_t getStableState() { return state; }
+
+    // pins that went high/low since the last call (and forget them)
+    static inline uint8_t takeRising() {
+        uint8_t edges;
+        ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+            edges  = rising;
+            rising = 0;
+        }
+        return edges;
+    }
+
+    static inline uint8_t takeFalling() {
+        uint8_t edges;
+        ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+            edges   = falling;
+            falling = 0;
+        }
+        return edges;
+    }
+
+    // the same, in button terms
+    static inline uint8_t takePressed() {
+        return passiveState ? takeFalling() : takeRising();
+    }
+
+    static inline uint8_t takeReleased() {
+        return passiveState ? takeRising() : takeFalling();
+    }
+
+    // pins currently (debounced) held away from their passive state
+    static inline uint8_t getHeld() {
+        return passiveState ? (~state & mask) : state;
+    }
+};
+
+
+}
+}
@@ -0,0 +1,121 @@
+#pragma once
+
+#include "common.hpp"
+
+#include <stdint.h>
+
+/**
+ * A fixed-size, single-producer/single-consumer ring buffer
+ *
+ * One side (say, an ISR) only ever calls `push` and the other side (say,
+ * the main loop) only ever calls `pop`, so neither needs to disable
+ * interrupts: the producer is the only writer of `head` and the consumer
+ * is the only writer of `tail`.
+ *
+ * `head` and `tail` are free-running 8-bit counters (they are never
+ * wrapped to the size) so `head - tail` is always the number of stored
+ * elements and a full buffer can be told apart from an empty one without
+ * wasting a slot. That's also why `size` has to be a power of two and
+ * no bigger than 128. Both counters are a single byte, so reading them
+ * is atomic on AVR.
+ */
+
+namespace HAL {
+namespace Utils {
+
+template<typename T, uint8_t size>
+class RingBuffer {
+
+    static_assert(size > 0 && size <= 128 && (size & (size - 1)) == 0,
+            "RingBuffer size must be a power of two no bigger than 128");
+
+    static constexpr uint8_t indexMask { size - 1 };
+
+    // `buf` isn't volatile, so without this the compiler could move the
+    // slot access past the (volatile) index update that hands it over
+    static inline void barrier() { __asm__ __volatile__("" ::: "memory"); }
+
+    T                buf[size];
+    volatile uint8_t head;
+    volatile uint8_t tail;
+
+  public:
+
+    constexpr RingBuffer()
+        : buf  { },
+          head { 0 },
+          tail { 0 } {
+    }
+
+    static constexpr uint8_t capacity() { return size; }
+
+    uint8_t count() const { return static_cast<uint8_t>(head - tail); }
+    bool    empty() const { return head == tail; }
+    bool    full()  const { return count() == size; }
+
+    // producer side
+    bool push(const T& value) {
+        uint8_t h = head;
+        if (static_cast<uint8_t>(h - tail) == size) return false;
+        buf[h & indexMask] = value;
+        barrier();
+        head = h + 1;
+        return true;
+    }
+
+    // consumer side
+    bool pop(T& value) {
+        uint8_t t = tail;
+        if (head == t) return false;
+        value = buf[t & indexMask];
+        barrier();
+        tail = t + 1;
+        return true;
+    }
+
+    // consumer side; `i`-th oldest element (no bounds checking)
+    const T& peek(uint8_t i = 0) const {
+        return buf[static_cast<uint8_t>(tail + i) & indexMask];
+    }
+
+    // consumer side; throw away the `n` oldest elements
+    void discard(uint8_t n) {
+        uint8_t available = count();
+        tail = tail + ((n < available) ? n : available);
+    }
+
+    // consumer side; position of the oldest element equal to `value`
+    // (counting from the oldest), or -1 if there isn't one
+    int16_t find(const T& value) const {
+        uint8_t n = count();
+        uint8_t t = tail;
+        for (uint8_t i = 0; i < n; ++i) {
+            if (buf[static_cast<uint8_t>(t + i) & indexMask] == value)
+                return i;
+        }
+        return -1;
+    }
+
+    // consumer side; the `n` oldest elements, in place, as (at most) two
+    // contiguous runs: the part before the end of the storage and the
+    // part that wrapped around to the start
+    void peekRuns(uint8_t n,
+                  const T*& first,  uint8_t& firstLength,
+                  const T*& second, uint8_t& secondLength) const {
+        uint8_t start   = tail & indexMask;
+        uint8_t toEnd   = size - start;
+        first           = &buf[start];
+        firstLength     = (n < toEnd) ? n : toEnd;
+        second          = &buf[0];
+        secondLength    = n - firstLength;
+    }
+
+    // only safe when the producer can't run (e.g. in an ATOMIC_BLOCK)
+    void clear() {
+        tail = head;
+    }
+};
+
+
+}
+}
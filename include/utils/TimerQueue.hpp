@@ -0,0 +1,207 @@
+#pragma once
+
+#include "common.hpp"
+
+#include <stdint.h>
+#include "ticker.hpp"
+
+/**
+ * Software timers on top of HAL::Ticker
+ *
+ * Instead of sprinkling `now - last >= interval` checks all over the main
+ * loop, register the callbacks with a TimerQueue
+ *
+        HAL::Utils::TimerQueue<4> timers;
+
+        auto blink = timers.startPeriodic(500, toggleLED);
+        timers.startOneShot(3000, turnOffBacklight);
+        ...
+        timers.cancel(blink);
+ *
+ * and call `timers.process()` from the main loop. It runs (in the main
+ * loop, not in an interrupt) every callback that is due.
+ *
+ * Timers are kept sorted by deadline, so finding out when the next one is
+ * due (`nextDeadline`, `ticksUntilNext`) is O(1); that's what the sleep
+ * code wants to know. Starting or cancelling a timer is O(capacity),
+ * which is fine for the handful of timers this is meant for.
+ *
+ * Every deadline is also handed to `HAL::Ticker::requestWakeAt`, so in
+ * tickless mode the ticker wakes up when a timer is due.
+ *
+ * All comparisons are on the difference between two tick counts, so they
+ * work across the 32-bit wraparound of getNumTicks() (as long as no delay
+ * is longer than ~24 days).
+ *
+ * Periodic timers are re-armed from their previous deadline, not from
+ * when process() got around to them, so they don't drift. If a periodic
+ * timer falls more than a whole period behind, it's re-armed from now
+ * instead of firing back-to-back to catch up.
+ *
+ * A TimerId carries a generation count along with its slot, so cancelling
+ * a timer that has already fired (and whose slot got reused) does nothing
+ * instead of cancelling someone else's timer.
+ *
+ * None of this is safe to call from an ISR.
+ */
+
+namespace HAL {
+namespace Utils {
+
+using TimerId = uint8_t;
+constexpr TimerId noTimer { 0xFF };
+
+template<uint8_t capacity>
+class TimerQueue {
+
+    static_assert(capacity > 0 && capacity <= 15,
+            "TimerQueue holds 1 to 15 timers");
+
+    struct Slot {
+        uint32_t deadline;
+        uint32_t period;       // 0 for one-shots
+        Callback callback;
+        uint8_t  generation;
+        bool     active;
+    };
+
+    Slot    slots[capacity];
+    uint8_t order[capacity];   // slot indices of active timers, soonest first
+    uint8_t count;
+
+    static constexpr bool before(uint32_t a, uint32_t b) {
+        return static_cast<int32_t>(a - b) < 0;
+    }
+
+    static constexpr TimerId makeId(uint8_t index, uint8_t generation) {
+        return static_cast<TimerId>((generation << 4) | index);
+    }
+
+    void insert(uint8_t index) {
+        uint8_t pos = count;
+        while (pos > 0 && before(slots[index].deadline,
+                                 slots[order[pos - 1]].deadline)) {
+            order[pos] = order[pos - 1];
+            --pos;
+        }
+        order[pos] = index;
+        ++count;
+        HAL::Ticker::requestWakeAt(slots[index].deadline);
+    }
+
+    void remove(uint8_t index) {
+        uint8_t pos = 0;
+        while (pos < count && order[pos] != index) ++pos;
+        if (pos == count) return;
+        for (; pos + 1 < count; ++pos) order[pos] = order[pos + 1];
+        --count;
+    }
+
+    TimerId start(uint32_t delay, uint32_t period, Callback callback) {
+        for (uint8_t i = 0; i < capacity; ++i) {
+            if (!slots[i].active) {
+                slots[i].deadline   = HAL::Ticker::getNumTicks() + delay;
+                slots[i].period     = period;
+                slots[i].callback   = callback;
+                slots[i].generation = (slots[i].generation + 1) & 0x0F;
+                slots[i].active     = true;
+                insert(i);
+                return makeId(i, slots[i].generation);
+            }
+        }
+        return noTimer;
+    }
+
+    // index of the slot `id` refers to, or capacity if it's stale
+    uint8_t resolve(TimerId id) const {
+        uint8_t index = id & 0x0F;
+        if (id == noTimer || index >= capacity) return capacity;
+        if (!slots[index].active) return capacity;
+        if (slots[index].generation != (id >> 4)) return capacity;
+        return index;
+    }
+
+  public:
+
+    TimerQueue()
+        : slots { },
+          order { },
+          count { 0 } {
+    }
+
+    // returns noTimer if the queue is full
+    TimerId startOneShot(uint32_t delay, Callback callback) {
+        return start(delay, 0, callback);
+    }
+
+    // first fires `period` ticks from now; a period of 0 is taken as 1
+    TimerId startPeriodic(uint32_t period, Callback callback) {
+        if (period == 0) period = 1;
+        return start(period, period, callback);
+    }
+
+    bool cancel(TimerId id) {
+        uint8_t index = resolve(id);
+        if (index == capacity) return false;
+        remove(index);
+        slots[index].active = false;
+        return true;
+    }
+
+    bool isActive(TimerId id) const {
+        return resolve(id) != capacity;
+    }
+
+    uint8_t activeCount() const { return count; }
+
+    // false if there are no timers
+    bool nextDeadline(uint32_t& when) const {
+        if (!count) return false;
+        when = slots[order[0]].deadline;
+        return true;
+    }
+
+    // 0 if something is due, 0xFFFFFFFF if there are no timers
+    uint32_t ticksUntilNext(uint32_t now) const {
+        if (!count) return 0xFFFFFFFF;
+        uint32_t when = slots[order[0]].deadline;
+        return before(now, when) ? (when - now) : 0;
+    }
+
+    uint32_t ticksUntilNext() const {
+        return ticksUntilNext(HAL::Ticker::getNumTicks());
+    }
+
+    // runs the callbacks of every timer that's due; returns how many
+    uint8_t process() {
+        uint32_t now   { HAL::Ticker::getNumTicks() };
+        uint8_t  fired { 0 };
+
+        // bounded so a callback that re-arms its own timer with a zero
+        // delay can't keep us in here forever
+        for (uint8_t n = 0; n < capacity && count; ++n) {
+            uint8_t index = order[0];
+            Slot&   slot  = slots[index];
+            if (before(now, slot.deadline)) break;
+
+            remove(index);
+            Callback callback = slot.callback;
+            if (slot.period) {
+                slot.deadline += slot.period;
+                if (!before(now, slot.deadline))
+                    slot.deadline = now + slot.period;
+                insert(index);
+            } else {
+                slot.active = false;
+            }
+
+            ++fired;
+            if (callback) callback();
+        }
+        return fired;
+    }
+};
+
+
+}
+}
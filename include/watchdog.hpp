@@ -3,10 +3,12 @@
 #include "common.hpp"
 
 #include <stdint.h>
+#include <util/atomic.h>
 
 #include <avr/interrupt.h>
 #include <avr/io.h>
 #include <avr/wdt.h>
+#include <avr/sleep.h>
 
 /**
  * WATCHDOG 
@@ -60,31 +62,50 @@
 namespace HAL {
 namespace Watchdog {
 
+// watchdog periods are 2^powOfTwo cycles of the 128 kHz oscillator,
+// 2^11 (16 ms) to 2^20 (8.2 s)
 static constexpr uint8_t getWDPrescalerBits(uint8_t powOfTwo) {
-    /*
-     * pow_of_two time (secs)
-     * 11         0.016
-     * 12         0.032
-     * 13         0.064
-     * 14         0.13
-     * 15         0.26
-     * 16         0.51
-     * 17         1.02
-     * 18         2.04
-     * 19         4.1
-     * 20         8.2
-     */
-    if      (powOfTwo == 11) return 0x00;
-    else if (powOfTwo == 12) return (1 << WDP0);
-    else if (powOfTwo == 13) return (1 << WDP1);
-    else if (powOfTwo == 14) return (1 << WDP1) | (1 << WDP0);
-    else if (powOfTwo == 15) return (1 << WDP2);
-    else if (powOfTwo == 16) return (1 << WDP2) | (1 << WDP0);
-    else if (powOfTwo == 17) return (1 << WDP2) | (1 << WDP1);
-    else if (powOfTwo == 18) return (1 << WDP2) | (1 << WDP1) | (1 << WDP0);
-    else if (powOfTwo == 19) return (1 << WDP3);
-    else if (powOfTwo == 20) return (1 << WDP3) | (1 << WDP0);
-    else                       return (1 << 0); // ???
+    // WDP3 isn't next to WDP2..0
+    uint8_t n = static_cast<uint8_t>(powOfTwo - 11);
+    return static_cast<uint8_t>(((n & 0x08) ? (1 << WDP3) : 0) | (n & 0x07));
+}
+
+// nominal length of a watchdog period, in milliseconds
+static constexpr uint32_t getWDPeriodMs(uint8_t powOfTwo) {
+    return 16UL << (powOfTwo - 11);
+}
+
+/**
+ * Put the watchdog in interrupt-only mode (no reset) with the given
+ * prescaler bits, restarting its count. Safe to call from an ISR (it
+ * doesn't touch the global interrupt flag beyond restoring it)
+ */
+inline void startInterruptMode(uint8_t prescalerBits) {
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        wdt_reset();
+        MCUSR &= static_cast<uint8_t>(~(1 << WDRF));
+#if defined(__AVR_ATtiny85__)
+        WDTCR |= (1 << WDCE) | (1 << WDE);
+        WDTCR = (1 << WDIF) | (1 << WDIE) | prescalerBits;
+#elif defined(__AVR_ATmega328P__)
+        WDTCSR |= (1 << WDCE) | (1 << WDE);
+        WDTCSR = (1 << WDIF) | (1 << WDIE) | prescalerBits;
+#endif
+    }
+}
+
+inline void stop() {
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        wdt_reset();
+        MCUSR &= static_cast<uint8_t>(~(1 << WDRF));
+#if defined(__AVR_ATtiny85__)
+        WDTCR |= (1 << WDCE) | (1 << WDE);
+        WDTCR = 0x00;
+#elif defined(__AVR_ATmega328P__)
+        WDTCSR |= (1 << WDCE) | (1 << WDE);
+        WDTCSR = 0x00;
+#endif
+    }
 }
 
 template<uint8_t prescalerPowOf2>
@@ -123,5 +144,155 @@ struct Watchdog {
     }
 };
 
+
+/**
+ * Runs tasks every so often off the watchdog, sleeping in between
+ *
+ * For things that wake up every few seconds, do a little work and go back
+ * to sleep, Timer0 (and so HAL::Ticker) doesn't need to run at all. This
+ * counts watchdog interrupts instead:
+ *
+        using Scheduler = HAL::Watchdog::Scheduler<8000>;
+        HAL_WATCHDOG_SCHEDULER_ISR(Scheduler)
+
+        Scheduler::add(readSensor);         // every 8 s
+        Scheduler::add(sendReport, 15);     // every 2 minutes
+        Scheduler::begin();
+        for (;;) Scheduler::sleep();
+ *
+ * The period is picked at compile time: the longest watchdog period that
+ * gets within 1/16th of `periodMs` (the oscillator is only good to ~10%
+ * anyway), chained `chain` times if `periodMs` is longer than one. So
+ * 8000 ms is a single 8.2 s period, 60000 ms is seven of them (57 s),
+ * and 100 ms is three 32 ms periods (96 ms); `actualMs` says what it
+ * came out as.
+ *
+ * The ISR only counts down the chain, so waking up between periods costs
+ * the interrupt and a couple of instructions before `sleep()` goes back
+ * to power-down. `sleep()` runs the tasks that are due (outside the ISR,
+ * with interrupts on) when the chain is done. A task added with
+ * `every` = n runs on every nth period.
+ *
+ * This owns the watchdog and WDT_vect, like HAL::Sleep::TimedSleep does,
+ * so the two can't be used together; and a watchdog running in reset
+ * mode (HAL::Watchdog::Watchdog<>) can't be a time base at the same time.
+ */
+
+template<uint32_t periodMs, uint8_t capacity=4>
+struct Scheduler {
+
+    // how many periods of 2^pow cycles come closest to periodMs
+    static constexpr uint32_t periodsOf(uint8_t pow) {
+        return (periodMs + getWDPeriodMs(pow) / 2) / getWDPeriodMs(pow);
+    }
+
+    static constexpr uint8_t choosePow() {
+        for (uint8_t pow = 20; pow > 11; --pow) {
+            uint32_t actual = periodsOf(pow) * getWDPeriodMs(pow);
+            uint32_t error  = (actual > periodMs) ? actual - periodMs
+                                                  : periodMs - actual;
+            if (periodsOf(pow) && error * 16 <= periodMs) return pow;
+        }
+        return 11;
+    }
+
+    static constexpr uint8_t pow { choosePow() };
+
+    static_assert(periodMs >= 16, "the shortest watchdog period is 16 ms");
+    static_assert(periodsOf(pow) <= 255, "periodMs is too long (max. ~35 minutes)");
+    static_assert(capacity > 0, "Scheduler needs room for at least one task");
+
+    static constexpr uint8_t  chain         { static_cast<uint8_t>(periodsOf(pow)) };
+    static constexpr uint8_t  prescalerBits { getWDPrescalerBits(pow) };
+    static constexpr uint32_t actualMs      { chain * getWDPeriodMs(pow) };
+
+    struct Task {
+        Callback callback;
+        uint8_t  every;
+        uint8_t  left;
+    };
+
+    static inline Task              tasks[capacity] { };
+    static inline uint8_t           count           { 0 };
+    static inline volatile uint8_t  chainLeft       { chain };
+    static inline volatile uint8_t  due             { 0 };
+
+    // false if the task list is full; every = 0 is taken as 1
+    static bool add(Callback callback, uint8_t every=1) {
+        if (count == capacity) return false;
+        if (every == 0) every = 1;
+        tasks[count++] = { callback, every, every };
+        return true;
+    }
+
+    static void begin() {
+        ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+            chainLeft = chain;
+            due       = 0;
+        }
+        startInterruptMode(prescalerBits);
+    }
+
+    static void end() {
+        stop();
+    }
+
+    // call this (and only this) from ISR(WDT_vect)
+    static inline void onWatchdogInterrupt() {
+        uint8_t left = chainLeft - 1;
+        if (left == 0) {
+            left = chain;
+            due  = due + 1;
+        }
+        chainLeft = left;
+    }
+
+    // runs whatever is due; returns how many periods that covered
+    static uint8_t dispatch() {
+        uint8_t periods;
+        ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+            periods = due;
+            due     = 0;
+        }
+        for (uint8_t p = 0; p < periods; ++p) {
+            for (uint8_t i = 0; i < count; ++i) {
+                Task& task = tasks[i];
+                if (--task.left == 0) {
+                    task.left = task.every;
+                    if (task.callback) task.callback();
+                }
+            }
+        }
+        return periods;
+    }
+
+    /**
+     * Sleeps in `mode` until a period is over and runs the tasks that are
+     * due. Other interrupts wake the MCU up too, but unless they end the
+     * period it goes straight back to sleep
+     */
+    static void sleep(uint8_t mode=SLEEP_MODE_PWR_DOWN) {
+        set_sleep_mode(mode);
+        cli();
+        while (!due) {
+            // the instruction after sei() runs before any interrupt can,
+            // so a period ending between the check and sleep_cpu() still
+            // wakes us up
+            sleep_enable();
+            sei();
+            sleep_cpu();
+            sleep_disable();
+            cli();
+        }
+        sei();
+        dispatch();
+    }
+};
+
+#define HAL_WATCHDOG_SCHEDULER_ISR(scheduler)             \
+    ISR(WDT_vect) {                                       \
+        scheduler::onWatchdogInterrupt();                 \
+    }
+
 }
 }
@@ -4,11 +4,16 @@
 #include <avr/io.h>
 #include <avr/interrupt.h> 
 
+#include "ticker.hpp"
+
 namespace HAL {
 namespace Ticker {
 
 volatile uint32_t ticks { 0 };
 volatile uint8_t paused { 0 }; // takes on TCCR0B if paused, 0 otherwise
+#if defined(HAL_TICKER_TICK_HOOK)
+Callback tickHook { nullptr };
+#endif
 
 constexpr struct PrescalerOption {
     uint16_t prescaler;
@@ -44,6 +49,14 @@ constexpr int findValidPrescalerIndex() {
     return -1;
 }
 
+#if defined(__AVR_ATtiny85__)
+#define TICKER_TIFR TIFR
+#elif defined(__AVR_ATmega328P__)
+#define TICKER_TIFR TIFR0
+#endif
+
+#if !defined(HAL_TICKER_TICKLESS)
+
 /**
  * We are looking to achieve 1000 Hz
  *   OCR0A = (F_CPU / (prescaler * 1000)) - 1
@@ -75,6 +88,183 @@ uint32_t getNumTicks() {
     return value;
 }
 
+/**
+ * Sub-millisecond time comes from TCNT0, which counts 0..OCR0A once per
+ * tick; one count is 1000/(OCR0A+1) us. That fraction is reduced at
+ * compile time so it's usually a single multiply (4 us/count at 16 MHz,
+ * 8 us/count at 8 MHz)
+ */
+
+constexpr uint16_t gcd(uint16_t a, uint16_t b) {
+    return b == 0 ? a : gcd(b, a % b);
+}
+
+constexpr uint16_t counts_per_ms {
+    static_cast<uint16_t>(F_CPU / (prescaler_options[findValidPrescalerIndex()].prescaler * 1000UL))
+};
+constexpr uint16_t us_scale_num { static_cast<uint16_t>(1000 / gcd(1000, counts_per_ms)) };
+constexpr uint16_t us_scale_den { static_cast<uint16_t>(counts_per_ms / gcd(1000, counts_per_ms)) };
+
+Timestamp getTimestamp() {
+    uint32_t ms;
+    uint8_t  counted;
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        ms      = ticks;
+        counted = TCNT0;
+        // matched (so the counter restarted) but the ISR hasn't run yet
+        if (TICKER_TIFR & (1 << OCF0A)) {
+            ++ms;
+            counted = TCNT0;
+        }
+    }
+    uint16_t us = static_cast<uint16_t>(counted) * us_scale_num;
+    if constexpr (us_scale_den > 1) us /= us_scale_den;
+    return { ms, us };
+}
+
+#else
+
+/**
+ * Tickless mode
+ *
+ * Timer0 runs with the biggest prescaler whose count period is a whole
+ * number of microseconds (no more than 1 ms), and the compare match only
+ * fires when a deadline registered with `requestWakeAt` is due, or when
+ * the 8-bit counter is about to run out (256 counts; ~16 ms at 16 MHz).
+ * That's ~60 interrupts a second when idle instead of 1000.
+ *
+ * `ticks` and `remainderUs` hold the time at the start of the current
+ * period (the last compare match); `getNumTicks` adds whatever TCNT0
+ * has counted since then.
+ *
+ * Timer0's clock is stopped in SLEEP_MODE_PWR_DOWN (and PWR_SAVE), so
+ * `pause`/`resume` are still needed for those. In SLEEP_MODE_IDLE it keeps
+ * counting and the CPU sleeps until the next deadline.
+ */
+
+constexpr int findTicklessPrescalerIndex() {
+    constexpr int count = sizeof(prescaler_options) / sizeof(prescaler_options[0]);
+    for (int i = count - 1; i >= 0; --i) {
+        uint32_t scaled = prescaler_options[i].prescaler * 1000000UL;
+        if ((scaled % F_CPU) == 0 && (scaled / F_CPU) <= 1000)
+            return i;
+    }
+    return -1;
+}
+
+constexpr int tickless_index = findTicklessPrescalerIndex();
+static_assert(tickless_index >= 0,
+        "No Timer0 prescaler gives a whole number of microseconds per count with F_CPU");
+
+constexpr uint16_t us_per_count {
+    static_cast<uint16_t>(prescaler_options[tickless_index].prescaler * 1000000UL / F_CPU)
+};
+constexpr uint16_t max_period_counts { 256 };
+
+volatile uint16_t remainderUs  { 0 };
+volatile uint16_t periodCounts { max_period_counts };
+volatile uint32_t deadline     { 0 };
+volatile bool     hasDeadline  { false };
+
+// call with interrupts off
+static void schedulePeriod() {
+    // a match is already pending; its ISR will reschedule
+    if (TICKER_TIFR & (1 << OCF0A)) return;
+
+    uint16_t counts { max_period_counts };
+    if (hasDeadline) {
+        int32_t msLeft = static_cast<int32_t>(deadline - ticks);
+        if (msLeft <= 0) {
+            counts = 1;
+        } else if (msLeft < 1000) {
+            uint32_t usLeft = static_cast<uint32_t>(msLeft) * 1000UL - remainderUs;
+            uint32_t needed = (usLeft + us_per_count - 1) / us_per_count;
+            if (needed < counts) counts = static_cast<uint16_t>(needed);
+        }
+    }
+
+    // the new compare value has to be ahead of the counter or it'd only
+    // match after wrapping around
+    uint16_t elapsed = TCNT0;
+    if (counts <= elapsed + 1) counts = elapsed + 2;
+    if (counts > max_period_counts) counts = max_period_counts;
+
+    periodCounts = counts;
+    OCR0A = static_cast<uint8_t>(counts - 1);
+}
+
+void setupMSTimer() {
+    constexpr auto opt = prescaler_options[tickless_index];
+
+    TCCR0A = (1 << WGM01); // CTC mode
+    TCCR0B = opt.cs_bits;
+    OCR0A  = static_cast<uint8_t>(max_period_counts - 1);
+    periodCounts = max_period_counts;
+
+#if defined(__AVR_ATtiny85__)
+    TIMSK |= (1 << OCIE0A);
+#elif defined(__AVR_ATmega328P__)
+    TIMSK0 |= (1 << OCIE0A);
+#endif
+}
+
+Timestamp getTimestamp() {
+    uint32_t ms;
+    uint32_t us;
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        ms = ticks;
+        us = remainderUs;
+        uint16_t counted = TCNT0;
+        // matched, but the ISR hasn't run yet (we're in an ISR, or
+        // it happened while we were in here) so the counter restarted
+        if (TICKER_TIFR & (1 << OCF0A))
+            counted = periodCounts + TCNT0;
+        us += static_cast<uint32_t>(counted) * us_per_count;
+    }
+    while (us >= 1000) {
+        ++ms;
+        us -= 1000;
+    }
+    return { ms, static_cast<uint16_t>(us) };
+}
+
+uint32_t getNumTicks() {
+    return getTimestamp().ms;
+}
+
+void requestWakeAt(uint32_t when) {
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        if (!hasDeadline || static_cast<int32_t>(when - deadline) < 0) {
+            deadline    = when;
+            hasDeadline = true;
+            schedulePeriod();
+        }
+    }
+}
+
+// called from the compare match ISR
+static inline void onPeriodElapsed() {
+    uint32_t t  = ticks;
+    uint32_t us = remainderUs + static_cast<uint32_t>(periodCounts) * us_per_count;
+    while (us >= 1000) {
+        ++t;
+        us -= 1000;
+    }
+    ticks       = t;
+    remainderUs = static_cast<uint16_t>(us);
+    if (hasDeadline && static_cast<int32_t>(deadline - t) <= 0) {
+        hasDeadline = false;
+    }
+    schedulePeriod();
+}
+
+#endif
+
+uint32_t getMicros() {
+    Timestamp now = getTimestamp();
+    return now.ms * 1000UL + now.us;
+}
+
 void pause() {
     paused = TCCR0B;
     TCCR0B = 0;
@@ -90,6 +280,24 @@ void resume(uint16_t compTicks) {
     }
 }
 
+#if defined(HAL_TICKER_TICK_HOOK)
+void setTickHook(Callback fnptr) {
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        tickHook = fnptr;
+    }
+}
+#endif
+
+void advance(uint32_t ms) {
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        ticks += ms;
+#if defined(HAL_TICKER_TICKLESS)
+        // deadlines may have just gone by
+        schedulePeriod();
+#endif
+    }
+}
+
 }
 }
 
@@ -99,7 +307,14 @@ ISR(TIM0_COMPA_vect) {
 #elif defined(__AVR_ATmega328P__)
 ISR(TIMER0_COMPA_vect) {
 #endif
+#if !defined(HAL_TICKER_TICKLESS)
     ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
         HAL::Ticker::ticks++;
     }
+#else
+    HAL::Ticker::onPeriodElapsed();
+#endif
+#if defined(HAL_TICKER_TICK_HOOK)
+    if (HAL::Ticker::tickHook) HAL::Ticker::tickHook();
+#endif
 }
@@ -5,10 +5,40 @@
 extern "C" {
     void init_lfsr(uint8_t seed);
     uint8_t get_next_byte(void);
+    void lfsr_fill(uint8_t* buf, size_t n);
+    void xorshift16_init(uint16_t seed);
+    uint16_t xorshift16_next(void);
+    void xorshift32_init(uint32_t seed);
+    uint32_t xorshift32_next(void);
 }
 
 namespace HAL::Utils::Random {
 
+// the generators give 1 .. 2^bits - 1, once each per period
+template<typename T, T (*next)()>
+static T uniform(T range) {
+    if (range <= 1) return 0;
+    constexpr T values = static_cast<T>(~T(0));
+    const T limit = values - values % range;
+    T value;
+    do {
+        value = static_cast<T>(next() - 1);
+    } while (value >= limit);
+    return value % range;
+}
+
+// store the bytes of a generator wider than one, low byte first
+template<typename T, T (*next)()>
+static void fillFrom(uint8_t* buf, size_t n) {
+    while (n) {
+        T value = next();
+        for (uint8_t i = 0; i < sizeof(T) && n; ++i, --n) {
+            *buf++ = static_cast<uint8_t>(value);
+            value >>= 8;
+        }
+    }
+}
+
 void LFSR::init(uint8_t seed) {
     init_lfsr(seed);
 }
@@ -17,4 +47,44 @@ uint8_t LFSR::nextByte() {
     return get_next_byte();
 }
 
+void LFSR::fill(uint8_t* buf, size_t n) {
+    lfsr_fill(buf, n);
+}
+
+uint8_t LFSR::uniform(uint8_t range) {
+    return Random::uniform<uint8_t, get_next_byte>(range);
+}
+
+void Xorshift16::init(uint16_t seed) {
+    xorshift16_init(seed);
+}
+
+uint16_t Xorshift16::next() {
+    return xorshift16_next();
+}
+
+void Xorshift16::fill(uint8_t* buf, size_t n) {
+    fillFrom<uint16_t, xorshift16_next>(buf, n);
+}
+
+uint16_t Xorshift16::uniform(uint16_t range) {
+    return Random::uniform<uint16_t, xorshift16_next>(range);
+}
+
+void Xorshift32::init(uint32_t seed) {
+    xorshift32_init(seed);
+}
+
+uint32_t Xorshift32::next() {
+    return xorshift32_next();
+}
+
+void Xorshift32::fill(uint8_t* buf, size_t n) {
+    fillFrom<uint32_t, xorshift32_next>(buf, n);
+}
+
+uint32_t Xorshift32::uniform(uint32_t range) {
+    return Random::uniform<uint32_t, xorshift32_next>(range);
+}
+
 }